@@ -0,0 +1,326 @@
+#ifndef BLOCKED_NEIGHBORS_H
+#define BLOCKED_NEIGHBORS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "DistanceKernels.h"
+
+// Leave-one-out nearest neighbors of a block of rows at once, solved as one
+// all-pairs problem. Squared distances are taken as |a|^2 + |b|^2 - 2 a.b,
+// with the dot products computed like a matrix multiply: a tile of query
+// rows against a tile of training rows, the tile's sums held in registers
+// while the selected columns stream past, and training rows taken a cache
+// block at a time. Only a running minimum and a short candidate list per
+// query row are kept, never the N x N distances.
+//
+// That formula rounds differently from summing squared differences (and
+// fuses multiply-adds), so it is only a screen. Every training row whose
+// screened distance is within a proven error bound of the row's smallest
+// is kept as a candidate, and the caller re-scores those exactly; the true
+// nearest row is always among them.
+
+// Query rows and training rows per register tile; the AVX2 tile is 4 x 8
+constexpr std::size_t ScreenTileRows = 4;
+constexpr std::size_t ScreenTileColumns = 32;
+
+// Training rows per cache block, revisited by every query tile of a block
+constexpr std::size_t ScreenBlockRows = 512;
+
+// The selected columns and each row's squared norm over them
+struct ScreenColumns
+{
+    const double *const *columns;
+    std::size_t numFeatures;
+    const double *norms;
+    std::size_t numRows;
+};
+
+// Screened neighbors of one query row
+struct NeighborScreen
+{
+    double minimum = std::numeric_limits<double>::max();
+    double tolerance = 0.0; // Twice the error bound of a screened distance
+    std::vector<std::pair<double, std::size_t>> candidates; // Screened distance, row
+
+    double limit() const
+    {
+        return minimum + tolerance;
+    }
+
+    void lower(double distance)
+    {
+        if (distance < minimum)
+        {
+            minimum = distance;
+        }
+    }
+
+    void offer(double distance, std::size_t row)
+    {
+        lower(distance);
+        if (distance <= limit())
+        {
+            candidates.emplace_back(distance, row);
+        }
+    }
+
+    // Drops the candidates a later, smaller minimum ruled out and leaves the
+    // rest ascending by row, so exact ties still go to the lowest index
+    void finish()
+    {
+        double final = limit();
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                        [&](const std::pair<double, std::size_t> &candidate)
+                                        { return candidate.first > final; }),
+                         candidates.end());
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const std::pair<double, std::size_t> &a, const std::pair<double, std::size_t> &b)
+                  { return a.second < b.second; });
+    }
+};
+
+// Twice the rounding error a screened distance of a row with squared norm
+// norm can have, against any row with squared norm at most maxNorm. The
+// norms and the dot product each err by at most d u times |a|^2 + |b|^2
+// (Cauchy-Schwarz bounds |a.b|), the exact sum of squared differences by
+// as much again, and the last two additions add a few u; this rounds all of
+// that up generously. u is the unit roundoff.
+inline double ScreenTolerance(std::size_t numFeatures, double norm, double maxNorm)
+{
+    return 16.0 * (numFeatures + 2) * std::numeric_limits<double>::epsilon() * (norm + maxNorm);
+}
+
+// Squared norm of every row over the selected columns
+inline std::vector<double> SquaredNorms(const double *const *columns, std::size_t numFeatures, std::size_t numRows)
+{
+    std::vector<double> norms(numRows, 0.0);
+    for (std::size_t j = 0; j < numFeatures; j++)
+    {
+        for (std::size_t k = 0; k < numRows; k++)
+        {
+            norms[k] += columns[j][k] * columns[j][k];
+        }
+    }
+    return norms;
+}
+
+// Screens query rows [i0, iEnd) against training rows [k0, kEnd), one
+// pair at a time; handles the ragged edges of the tiled kernels
+inline void ScreenTileScalar(const ScreenColumns &data, std::size_t i0, std::size_t iEnd, std::size_t k0,
+                             std::size_t kEnd, NeighborScreen *screens)
+{
+    for (std::size_t i = i0; i < iEnd; i++)
+    {
+        NeighborScreen &screen = screens[i - i0];
+        for (std::size_t k = k0; k < kEnd; k++)
+        {
+            if (k == i)
+            {
+                continue;
+            }
+            double dot = 0.0;
+            for (std::size_t j = 0; j < data.numFeatures; j++)
+            {
+                dot += data.columns[j][i] * data.columns[j][k];
+            }
+            screen.offer(data.norms[i] + data.norms[k] - 2.0 * dot, k);
+        }
+    }
+}
+
+#ifdef DISTANCE_KERNELS_X86
+
+// Same GCC 12 intrinsic-header false positive as in DistanceKernels.h
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// 4 query rows against 32 training rows: the 4 x 32 dot products live in
+// 16 registers, each column costs 4 loads, 4 broadcasts and 16 multiply-adds
+__attribute__((target("avx512f"))) inline void ScreenTileAVX512(const ScreenColumns &data, std::size_t i0,
+                                                                std::size_t k0, NeighborScreen *screens)
+{
+    __m512d dots[ScreenTileRows][4];
+    #pragma GCC unroll 4
+    for (std::size_t r = 0; r < ScreenTileRows; r++)
+    {
+        #pragma GCC unroll 4
+        for (std::size_t q = 0; q < 4; q++)
+        {
+            dots[r][q] = _mm512_setzero_pd();
+        }
+    }
+    for (std::size_t j = 0; j < data.numFeatures; j++)
+    {
+        const double *column = data.columns[j];
+        __m512d training[4];
+        #pragma GCC unroll 4
+        for (std::size_t q = 0; q < 4; q++)
+        {
+            training[q] = _mm512_loadu_pd(column + k0 + 8 * q);
+        }
+        #pragma GCC unroll 4
+        for (std::size_t r = 0; r < ScreenTileRows; r++)
+        {
+            __m512d query = _mm512_set1_pd(column[i0 + r]);
+            #pragma GCC unroll 4
+            for (std::size_t q = 0; q < 4; q++)
+            {
+                dots[r][q] = _mm512_fmadd_pd(query, training[q], dots[r][q]);
+            }
+        }
+    }
+
+    const __m512d infinity = _mm512_set1_pd(std::numeric_limits<double>::infinity());
+    #pragma GCC unroll 4
+    for (std::size_t r = 0; r < ScreenTileRows; r++)
+    {
+        std::size_t i = i0 + r;
+        __m512d queryNorm = _mm512_set1_pd(data.norms[i]);
+        __m512d distances[4];
+        #pragma GCC unroll 4
+        for (std::size_t q = 0; q < 4; q++)
+        {
+            __m512d sums = _mm512_add_pd(queryNorm, _mm512_loadu_pd(data.norms + k0 + 8 * q));
+            distances[q] = _mm512_fnmadd_pd(_mm512_set1_pd(2.0), dots[r][q], sums);
+            if (i >= k0 + 8 * q && i < k0 + 8 * q + 8)
+            {
+                distances[q] = _mm512_mask_mov_pd(distances[q], static_cast<__mmask8>(1u << (i - k0 - 8 * q)), infinity);
+            }
+        }
+        NeighborScreen &screen = screens[r];
+        screen.lower(_mm512_reduce_min_pd(_mm512_min_pd(_mm512_min_pd(distances[0], distances[1]),
+                                                        _mm512_min_pd(distances[2], distances[3]))));
+        __m512d limit = _mm512_set1_pd(screen.limit());
+        #pragma GCC unroll 4
+        for (std::size_t q = 0; q < 4; q++)
+        {
+            unsigned mask = _mm512_cmp_pd_mask(distances[q], limit, _CMP_LE_OQ);
+            if (mask != 0)
+            {
+                alignas(64) double lanes[8];
+                _mm512_store_pd(lanes, distances[q]);
+                for (; mask != 0; mask &= mask - 1)
+                {
+                    unsigned lane = __builtin_ctz(mask);
+                    screen.candidates.emplace_back(lanes[lane], k0 + 8 * q + lane);
+                }
+            }
+        }
+    }
+}
+
+// 4 query rows against 8 training rows in 8 registers, without fused
+// multiply-adds since AVX2 does not imply them
+__attribute__((target("avx2"))) inline void ScreenTileAVX2(const ScreenColumns &data, std::size_t i0,
+                                                           std::size_t k0, NeighborScreen *screens)
+{
+    __m256d dots[ScreenTileRows][2];
+    #pragma GCC unroll 4
+    for (std::size_t r = 0; r < ScreenTileRows; r++)
+    {
+        dots[r][0] = _mm256_setzero_pd();
+        dots[r][1] = _mm256_setzero_pd();
+    }
+    for (std::size_t j = 0; j < data.numFeatures; j++)
+    {
+        const double *column = data.columns[j];
+        __m256d training0 = _mm256_loadu_pd(column + k0);
+        __m256d training1 = _mm256_loadu_pd(column + k0 + 4);
+        #pragma GCC unroll 4
+        for (std::size_t r = 0; r < ScreenTileRows; r++)
+        {
+            __m256d query = _mm256_set1_pd(column[i0 + r]);
+            dots[r][0] = _mm256_add_pd(dots[r][0], _mm256_mul_pd(query, training0));
+            dots[r][1] = _mm256_add_pd(dots[r][1], _mm256_mul_pd(query, training1));
+        }
+    }
+
+    #pragma GCC unroll 4
+
+    for (std::size_t r = 0; r < ScreenTileRows; r++)
+    {
+        std::size_t i = i0 + r;
+        alignas(32) double distances[8];
+        __m256d queryNorm = _mm256_set1_pd(data.norms[i]);
+        for (std::size_t q = 0; q < 2; q++)
+        {
+            __m256d sums = _mm256_add_pd(queryNorm, _mm256_loadu_pd(data.norms + k0 + 4 * q));
+            _mm256_store_pd(distances + 4 * q, _mm256_sub_pd(sums, _mm256_add_pd(dots[r][q], dots[r][q])));
+        }
+        if (i >= k0 && i < k0 + 8)
+        {
+            distances[i - k0] = std::numeric_limits<double>::infinity();
+        }
+        NeighborScreen &screen = screens[r];
+        double tileMin = distances[0];
+        for (std::size_t c = 1; c < 8; c++)
+        {
+            tileMin = std::min(tileMin, distances[c]);
+        }
+        screen.lower(tileMin);
+        double limit = screen.limit();
+        for (std::size_t c = 0; c < 8; c++)
+        {
+            if (distances[c] <= limit)
+            {
+                screen.candidates.emplace_back(distances[c], k0 + c);
+            }
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+// Screens query rows [queryBegin, queryEnd) against every row with the
+// active kernel, then finishes each row's screen. screens[r] belongs to
+// query row queryBegin + r and arrives with its tolerance set.
+inline void ScreenNeighbors(const ScreenColumns &data, std::size_t queryBegin, std::size_t queryEnd,
+                            NeighborScreen *screens)
+{
+    std::size_t tileColumns = 0;
+#ifdef DISTANCE_KERNELS_X86
+    DistanceKernel kernel = ActiveDistanceKernel();
+    tileColumns = kernel == DistanceKernel::AVX512 ? ScreenTileColumns : kernel == DistanceKernel::AVX2 ? 8 : 0;
+#endif
+
+    for (std::size_t blockBegin = 0; blockBegin < data.numRows; blockBegin += ScreenBlockRows)
+    {
+        std::size_t blockEnd = std::min(blockBegin + ScreenBlockRows, data.numRows);
+        std::size_t i0 = queryBegin;
+        if (tileColumns != 0)
+        {
+            for (; i0 + ScreenTileRows <= queryEnd; i0 += ScreenTileRows)
+            {
+                std::size_t k0 = blockBegin;
+                for (; k0 + tileColumns <= blockEnd; k0 += tileColumns)
+                {
+#ifdef DISTANCE_KERNELS_X86
+                    if (kernel == DistanceKernel::AVX512)
+                    {
+                        ScreenTileAVX512(data, i0, k0, screens + (i0 - queryBegin));
+                    }
+                    else
+                    {
+                        ScreenTileAVX2(data, i0, k0, screens + (i0 - queryBegin));
+                    }
+#endif
+                }
+                ScreenTileScalar(data, i0, i0 + ScreenTileRows, k0, blockEnd, screens + (i0 - queryBegin));
+            }
+        }
+        ScreenTileScalar(data, i0, queryEnd, blockBegin, blockEnd, screens + (i0 - queryBegin));
+    }
+
+    for (std::size_t r = 0; r < queryEnd - queryBegin; r++)
+    {
+        screens[r].finish();
+    }
+}
+
+#endif
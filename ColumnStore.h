@@ -0,0 +1,345 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Dataset.h"
+#include "DataParser.h"
+#include "DatasetCache.h"
+#include "ThreadPool.h"
+#include "Metrics.h"
+
+// Normalized columns kept on disk in the dataset cache format and read back
+// a block of rows at a time, for datasets too large to hold in memory. Only
+// the labels stay resident.
+class ColumnStore
+{
+private:
+    std::string path;
+    DatasetCache::Header header;
+    mutable std::ifstream file;
+    mutable std::mutex fileMutex; // Concurrent evaluations take turns reading
+
+    void read(std::uint64_t offset, void *destination, std::size_t bytes) const
+    {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        file.seekg(static_cast<std::streamoff>(offset));
+        if (!file.read(static_cast<char *>(destination), static_cast<std::streamsize>(bytes)))
+        {
+            throw std::runtime_error("Cannot read column store: " + path);
+        }
+    }
+
+public:
+    explicit ColumnStore(const std::string &path)
+        : path(path), file(path, std::ios::binary)
+    {
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open column store: " + path);
+        }
+        file.seekg(0, std::ios::end);
+        std::uint64_t fileSize = static_cast<std::uint64_t>(file.tellg());
+        file.seekg(0);
+        if (fileSize < sizeof(header) || !file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            !DatasetCache::IsIntact(header, fileSize))
+        {
+            throw std::runtime_error("Damaged column store: " + path);
+        }
+    }
+
+    ColumnStore(const ColumnStore &) = delete;
+    ColumnStore &operator=(const ColumnStore &) = delete;
+
+    const DatasetCache::Header &getHeader() const
+    {
+        return header;
+    }
+
+    std::size_t getNumInstances() const
+    {
+        return static_cast<std::size_t>(header.numInstances);
+    }
+
+    std::size_t getNumColumns() const
+    {
+        return static_cast<std::size_t>(header.numColumns);
+    }
+
+    std::vector<int> readLabels() const
+    {
+        std::vector<std::int32_t> stored(getNumInstances());
+        read(header.labelsOffset, stored.data(), stored.size() * sizeof(std::int32_t));
+        return std::vector<int>(stored.begin(), stored.end());
+    }
+
+    // Rows [begin, begin + count) of the given columns, in the order given
+    Dataset readBlock(const std::size_t *features, std::size_t numFeatures, std::size_t begin, std::size_t count) const
+    {
+        NN_METRIC_COUNT("column_store_read_bytes", count * numFeatures * sizeof(double));
+        Dataset block(count, numFeatures);
+        for (std::size_t j = 0; j < numFeatures; j++)
+        {
+            std::uint64_t offset = header.columnsOffset + (features[j] * header.columnStride + begin) * sizeof(double);
+            read(offset, block.column(j), count * sizeof(double));
+        }
+        return block;
+    }
+};
+
+namespace ColumnStoreIngest
+{
+    // Smallest slice of text read at a time
+    constexpr std::size_t MinWindowBytes = std::size_t(1) << 20;
+
+    // Reads a text file a window of whole lines at a time, parses each
+    // window on the pool and hands its chunks to visit in file order. A line
+    // longer than the window grows the window to fit it. Every byte read is
+    // fed to checksum if one is given.
+    template <typename Visit>
+    void ForEachWindow(const std::string &path, std::size_t windowBytes, ThreadPool &pool, const Visit &visit,
+                       SourceChecksum *checksum = nullptr)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+
+        std::vector<char> buffer;
+        std::size_t carried = 0; // Bytes of an unfinished line kept from the last window
+        while (true)
+        {
+            buffer.resize(carried + windowBytes);
+            file.read(buffer.data() + carried, static_cast<std::streamsize>(windowBytes));
+            std::size_t filled = carried + static_cast<std::size_t>(file.gcount());
+            bool atEnd = !file;
+            if (checksum != nullptr)
+            {
+                checksum->update(buffer.data() + carried, filled - carried);
+            }
+
+            std::size_t usable = filled;
+            if (!atEnd)
+            {
+                auto lastNewline = std::find(buffer.rbegin() + (buffer.size() - filled), buffer.rend(), '\n');
+                if (lastNewline == buffer.rend())
+                {
+                    carried = filled;
+                    continue;
+                }
+                usable = static_cast<std::size_t>(buffer.rend() - lastNewline);
+            }
+
+            visit(DataParser::ParseChunks(buffer.data(), usable, pool));
+            if (atEnd)
+            {
+                return;
+            }
+            std::copy(buffer.begin() + usable, buffer.begin() + filled, buffer.begin());
+            carried = filled - usable;
+        }
+    }
+
+    // Checksum of a file's bytes, read a window at a time
+    inline std::uint64_t ChecksumFile(const std::string &path, std::size_t windowBytes)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        SourceChecksum checksum;
+        std::vector<char> buffer(windowBytes);
+        while (file)
+        {
+            file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            checksum.update(buffer.data(), static_cast<std::size_t>(file.gcount()));
+        }
+        return checksum.value();
+    }
+
+    // Writes count bytes at offset, growing the file as needed
+    inline void WriteAt(std::ofstream &file, std::uint64_t offset, const void *bytes, std::size_t count)
+    {
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(static_cast<const char *>(bytes), static_cast<std::streamsize>(count));
+    }
+
+    // Streams a text dataset with one instance per line into a column store
+    // at storePath in two passes: the first finds every column's minimum and
+    // maximum, the second normalizes each window of rows and writes its
+    // slice of every column. Values and normalization match
+    // LoadPreparedDataset exactly, so the store doubles as its cache.
+    inline void Build(const std::string &sourcePath, std::uint64_t sourceSize, const std::string &storePath,
+                      std::size_t windowBytes, ThreadPool &pool)
+    {
+        NN_METRIC_TIMER("column_store_build");
+        SourceChecksum checksum;
+        std::size_t numInstances = 0;
+        std::size_t numValues = 0;
+        std::vector<double> minimums;
+        std::vector<double> maximums;
+
+        // First pass: shape and per-column bounds
+        ForEachWindow(sourcePath, windowBytes, pool, [&](const std::vector<DataParser::Chunk> &chunks)
+                      {
+                          for (const DataParser::Chunk &chunk : chunks)
+                          {
+                              if (chunk.numInstances == 0)
+                              {
+                                  continue;
+                              }
+                              if (chunk.inconsistent || (numInstances != 0 && chunk.numValues != numValues))
+                              {
+                                  throw std::runtime_error("Inconsistent number of values across instances");
+                              }
+                              if (numInstances == 0)
+                              {
+                                  numValues = chunk.numValues;
+                                  minimums.assign(chunk.values.begin(), chunk.values.begin() + numValues);
+                                  maximums = minimums;
+                              }
+                              for (std::size_t i = 0; i < chunk.numInstances; i++)
+                              {
+                                  for (std::size_t j = 0; j < numValues; j++)
+                                  {
+                                      double value = chunk.values[i * numValues + j];
+                                      minimums[j] = std::min(minimums[j], value);
+                                      maximums[j] = std::max(maximums[j], value);
+                                  }
+                              }
+                              numInstances += chunk.numInstances;
+                          }
+                      },
+                      &checksum);
+
+        // The first value of each instance is its label, the rest features
+        std::size_t numFeatures = numValues == 0 ? 0 : numValues - 1;
+        DatasetCache::Header header = DatasetCache::Layout(numInstances, numFeatures);
+        header.sourceSize = sourceSize;
+        header.sourceChecksum = checksum.value();
+
+        std::string temporaryPath = DatasetCache::TemporaryPathFor(storePath);
+        std::ofstream store(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!store)
+        {
+            throw std::runtime_error("Cannot write column store: " + temporaryPath);
+        }
+        WriteAt(store, 0, &header, sizeof(header));
+        if (numFeatures > 0)
+        {
+            WriteAt(store, header.boundsOffset, minimums.data() + 1, numFeatures * sizeof(double));
+            WriteAt(store, header.boundsOffset + numFeatures * sizeof(double), maximums.data() + 1,
+                    numFeatures * sizeof(double));
+        }
+        char zero = 0;
+        WriteAt(store, header.fileSize - 1, &zero, 1); // Sizes the file; padding reads back as zeros
+
+        // Second pass: normalized slices of every column
+        std::size_t firstRow = 0;
+        std::vector<std::int32_t> labels;
+        std::vector<double> slice;
+        ForEachWindow(sourcePath, windowBytes, pool, [&](const std::vector<DataParser::Chunk> &chunks)
+                      {
+                          for (const DataParser::Chunk &chunk : chunks)
+                          {
+                              std::size_t rows = chunk.numInstances;
+                              if (rows == 0)
+                              {
+                                  continue;
+                              }
+                              if (chunk.inconsistent || chunk.numValues != numValues || firstRow + rows > numInstances)
+                              {
+                                  throw std::runtime_error("File changed while reading: " + sourcePath);
+                              }
+
+                              labels.resize(rows);
+                              for (std::size_t i = 0; i < rows; i++)
+                              {
+                                  labels[i] = static_cast<std::int32_t>(chunk.values[i * numValues]);
+                              }
+                              WriteAt(store, header.labelsOffset + firstRow * sizeof(std::int32_t), labels.data(),
+                                      rows * sizeof(std::int32_t));
+
+                              slice.resize(rows);
+                              for (std::size_t j = 1; j < numValues; j++)
+                              {
+                                  double minVal = minimums[j];
+                                  double maxVal = maximums[j];
+                                  for (std::size_t i = 0; i < rows; i++)
+                                  {
+                                      double value = chunk.values[i * numValues + j];
+                                      slice[i] = maxVal > minVal ? (value - minVal) / (maxVal - minVal) : value;
+                                  }
+                                  std::uint64_t offset = header.columnsOffset +
+                                                         ((j - 1) * header.columnStride + firstRow) * sizeof(double);
+                                  WriteAt(store, offset, slice.data(), rows * sizeof(double));
+                              }
+                              firstRow += rows;
+                          }
+                      });
+
+        store.close();
+        if (!store || firstRow != numInstances)
+        {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Cannot write column store: " + temporaryPath);
+        }
+        if (std::rename(temporaryPath.c_str(), storePath.c_str()) != 0)
+        {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Cannot write column store: " + storePath);
+        }
+    }
+}
+
+// Opens the column store for a text dataset with one instance per line,
+// building it first unless a store or cache built from the same bytes is
+// already there. Ingest holds about memoryBudget bytes of text and parsed
+// values at a time, however large the file is.
+inline std::unique_ptr<ColumnStore> OpenColumnStore(const std::string &sourcePath, std::size_t memoryBudget,
+                                                    ThreadPool &pool)
+{
+    // Leaves room for the values parsed from a window, 8 bytes per number
+    std::size_t windowBytes = std::max(ColumnStoreIngest::MinWindowBytes, memoryBudget / 4);
+    std::string storePath = DatasetCache::PathFor(sourcePath);
+
+    std::uint64_t sourceSize;
+    {
+        std::ifstream source(sourcePath, std::ios::binary | std::ios::ate);
+        if (!source)
+        {
+            throw std::runtime_error("Cannot open file: " + sourcePath);
+        }
+        sourceSize = static_cast<std::uint64_t>(source.tellg());
+    }
+
+    try
+    {
+        std::unique_ptr<ColumnStore> existing = std::make_unique<ColumnStore>(storePath);
+        const DatasetCache::Header &header = existing->getHeader();
+        if (header.groupWidth == 0 && header.sourceSize == sourceSize &&
+            header.sourceChecksum == ColumnStoreIngest::ChecksumFile(sourcePath, windowBytes))
+        {
+            return existing;
+        }
+    }
+    catch (const std::runtime_error &)
+    {
+        // Missing or damaged; rebuild it
+    }
+
+    ColumnStoreIngest::Build(sourcePath, sourceSize, storePath, windowBytes, pool);
+    return std::make_unique<ColumnStore>(storePath);
+}
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef DATA_PARSER_H
+#define DATA_PARSER_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "Dataset.h"
+#include "ThreadPool.h"
+#include "Metrics.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DATA_PARSER_HAS_MMAP 1
+#endif
+
+// A whole file mapped read-only into memory. Where mmap is not available
+// the file is read into a buffer instead.
+class MappedFile
+{
+private:
+    const char *bytes = nullptr;
+    std::size_t length = 0;
+#ifdef DATA_PARSER_HAS_MMAP
+    void *mapping = nullptr;
+#else
+    std::string buffer;
+#endif
+
+public:
+    explicit MappedFile(const std::string &path)
+    {
+#ifdef DATA_PARSER_HAS_MMAP
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0)
+        {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        struct stat status;
+        if (::fstat(descriptor, &status) != 0)
+        {
+            ::close(descriptor);
+            throw std::runtime_error("Cannot read file: " + path);
+        }
+        length = static_cast<std::size_t>(status.st_size);
+        if (length > 0)
+        {
+            mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapping == MAP_FAILED)
+            {
+                mapping = nullptr;
+                ::close(descriptor);
+                throw std::runtime_error("Cannot map file: " + path);
+            }
+            ::madvise(mapping, length, MADV_SEQUENTIAL);
+            bytes = static_cast<const char *>(mapping);
+        }
+        ::close(descriptor);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef DATA_PARSER_HAS_MMAP
+        if (mapping != nullptr)
+        {
+            ::munmap(mapping, length);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const
+    {
+        return bytes;
+    }
+
+    std::size_t size() const
+    {
+        return length;
+    }
+};
+
+namespace DataParser
+{
+    // Files smaller than this are parsed on one thread
+    constexpr std::size_t MinChunkBytes = std::size_t(1) << 20;
+
+    // Rows copied into the columns together when building the Dataset
+    constexpr std::size_t TransposeBlockRows = 256;
+
+    // The values of one slice of the file, one instance after another
+    struct Chunk
+    {
+        std::vector<double> values;
+        std::size_t numInstances = 0;
+        std::size_t numValues = 0;  // Width of every instance in the chunk
+        bool inconsistent = false;  // Two instances had different widths
+        bool stoppedEarly = false;  // Hit a token that is not a number
+        std::size_t valuesBeforeStop = 0; // Values parsed before that token
+    };
+
+    // Whitespace within a line, as skipped by operator>>
+    inline bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Parses a plain decimal whose significand fits in 53 bits and whose
+    // power of ten is at most 22. Both are then exact doubles, so one
+    // multiplication or division gives the correctly rounded result, the
+    // same one from_chars would. Returns nullptr for anything else.
+    inline const char *ParseShortDecimal(const char *p, const char *end, double &value)
+    {
+        static const double PowersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        constexpr std::uint64_t MaxExactSignificand = std::uint64_t(1) << 53;
+
+        bool negative = false;
+        if (p != end && (*p == '+' || *p == '-'))
+        {
+            negative = *p == '-';
+            p++;
+        }
+
+        std::uint64_t significand = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        for (; p != end && *p >= '0' && *p <= '9'; p++, numDigits++)
+        {
+            significand = significand * 10 + static_cast<std::uint64_t>(*p - '0');
+        }
+        if (p != end && *p == '.')
+        {
+            for (p++; p != end && *p >= '0' && *p <= '9'; p++, numDigits++, exponent--)
+            {
+                significand = significand * 10 + static_cast<std::uint64_t>(*p - '0');
+            }
+        }
+        if (numDigits == 0 || numDigits > 18)
+        {
+            return nullptr;
+        }
+
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            const char *q = p + 1;
+            bool negativeExponent = false;
+            if (q != end && (*q == '+' || *q == '-'))
+            {
+                negativeExponent = *q == '-';
+                q++;
+            }
+            int exponentDigits = 0;
+            int written = 0;
+            for (; q != end && *q >= '0' && *q <= '9'; q++, exponentDigits++)
+            {
+                written = written * 10 + (*q - '0');
+                if (exponentDigits > 4)
+                {
+                    return nullptr;
+                }
+            }
+            if (exponentDigits == 0)
+            {
+                return nullptr;
+            }
+            exponent += negativeExponent ? -written : written;
+            p = q;
+        }
+
+        if (significand > MaxExactSignificand || exponent < -22 || exponent > 22)
+        {
+            return nullptr;
+        }
+        double magnitude = static_cast<double>(significand);
+        magnitude = exponent < 0 ? magnitude / PowersOfTen[-exponent] : magnitude * PowersOfTen[exponent];
+        value = negative ? -magnitude : magnitude;
+        return p;
+    }
+
+    // Parses one number starting at p, the way operator>> would: an optional
+    // sign followed by a decimal or scientific-notation value. Returns the
+    // position after it, or nullptr if p does not start a number.
+    inline const char *ParseNumber(const char *p, const char *end, double &value)
+    {
+        const char *digits = p;
+        if (digits != end && (*digits == '+' || *digits == '-'))
+        {
+            digits++;
+        }
+        // from_chars also takes "inf" and "nan", which operator>> rejects
+        if (digits == end || !((*digits >= '0' && *digits <= '9') || *digits == '.'))
+        {
+            return nullptr;
+        }
+
+        const char *next = ParseShortDecimal(p, end, value);
+        if (next == nullptr)
+        {
+            // from_chars takes a leading minus but not a leading plus
+            std::from_chars_result result = std::from_chars(digits - (*p == '-' ? 1 : 0), end, value);
+            next = result.ptr;
+            if (result.ec == std::errc::result_out_of_range)
+            {
+                // operator>> fails on overflow but keeps an underflowed
+                // value, which strtod rounds to zero or a subnormal
+                std::string token(p, next);
+                value = std::strtod(token.c_str(), nullptr);
+                if (std::isinf(value))
+                {
+                    return nullptr;
+                }
+            }
+            else if (result.ec != std::errc())
+            {
+                return nullptr;
+            }
+
+            // operator>> consumes a dangling exponent marker ("1e", "2.5e+")
+            // and then rejects the whole token
+            bool hasExponent = std::find_if(p, next, [](char c)
+                                            { return c == 'e' || c == 'E'; }) != next;
+            if (next != end && (*next == 'e' || *next == 'E') && !hasExponent)
+            {
+                return nullptr;
+            }
+        }
+        return next;
+    }
+
+    // Parses the lines in [begin, end). Each line holding at least one number
+    // is an instance; parsing of a line stops at its first non-number token.
+    inline void ParseLines(const char *begin, const char *end, Chunk &chunk)
+    {
+        const char *p = begin;
+        while (p < end)
+        {
+            std::size_t lineValues = 0;
+            bool lineStopped = false;
+            while (true)
+            {
+                while (p < end && IsBlank(*p))
+                {
+                    p++;
+                }
+                if (p == end || *p == '\n')
+                {
+                    break;
+                }
+
+                double value;
+                const char *next = ParseNumber(p, end, value);
+                if (next == nullptr)
+                {
+                    lineStopped = true;
+                    break;
+                }
+                chunk.values.push_back(value);
+                lineValues++;
+                p = next;
+            }
+
+            if (lineStopped)
+            {
+                if (!chunk.stoppedEarly)
+                {
+                    chunk.stoppedEarly = true;
+                    chunk.valuesBeforeStop = chunk.values.size();
+                }
+                p = std::find(p, end, '\n');
+            }
+            if (p < end)
+            {
+                p++; // Step over the newline
+            }
+
+            if (lineValues == 0)
+            {
+                continue;
+            }
+            if (chunk.numInstances == 0)
+            {
+                chunk.numValues = lineValues;
+            }
+            else if (lineValues != chunk.numValues)
+            {
+                chunk.inconsistent = true;
+            }
+            chunk.numInstances++;
+        }
+    }
+
+    // Splits [text, text + length) into slices that end on line boundaries
+    // and parses them in parallel
+    inline std::vector<Chunk> ParseChunks(const char *text, std::size_t length, ThreadPool &pool)
+    {
+        std::size_t numChunks = std::max<std::size_t>(1, std::min(length / MinChunkBytes, pool.size() * 4));
+        std::vector<const char *> bounds(numChunks + 1);
+        bounds[0] = text;
+        bounds[numChunks] = text + length;
+        for (std::size_t c = 1; c < numChunks; c++)
+        {
+            const char *guess = std::max(text + length * c / numChunks, bounds[c - 1]);
+            const char *newline = std::find(guess, text + length, '\n');
+            bounds[c] = newline == text + length ? newline : newline + 1;
+        }
+
+        std::vector<Chunk> chunks(numChunks);
+        pool.parallelFor(numChunks, 1, [&](std::size_t begin, std::size_t end, std::size_t)
+                         {
+                             for (std::size_t c = begin; c < end; c++)
+                             {
+                                 ParseLines(bounds[c], bounds[c + 1], chunks[c]);
+                             }
+                         });
+        return chunks;
+    }
+
+    // Copies the chunks' instances into a Dataset, in file order
+    inline Dataset Gather(const std::vector<Chunk> &chunks, std::size_t numInstances,
+                          std::size_t numValues, ThreadPool &pool)
+    {
+        std::vector<std::size_t> firstInstance(chunks.size() + 1, 0);
+        for (std::size_t c = 0; c < chunks.size(); c++)
+        {
+            firstInstance[c + 1] = firstInstance[c] + (numValues == 0 ? 0 : chunks[c].values.size() / numValues);
+        }
+
+        Dataset dataset(numInstances, numValues);
+        pool.parallelFor(chunks.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t)
+                         {
+                             for (std::size_t c = begin; c < end; c++)
+                             {
+                                 const std::vector<double> &values = chunks[c].values;
+                                 std::size_t rows = firstInstance[c + 1] - firstInstance[c];
+                                 // Transpose a block of rows at a time so the rows being
+                                 // read stay in cache while each column is written
+                                 for (std::size_t blockBegin = 0; blockBegin < rows; blockBegin += TransposeBlockRows)
+                                 {
+                                     std::size_t blockEnd = std::min(blockBegin + TransposeBlockRows, rows);
+                                     for (std::size_t j = 0; j < numValues; j++)
+                                     {
+                                         double *column = dataset.column(j) + firstInstance[c];
+                                         for (std::size_t i = blockBegin; i < blockEnd; i++)
+                                         {
+                                             column[i] = values[i * numValues + j];
+                                         }
+                                     }
+                                 }
+                             }
+                         });
+        return dataset;
+    }
+}
+
+// Parses text holding one instance per line, values separated by
+// whitespace. Blank lines are skipped; every other line must hold the same
+// number of values.
+inline Dataset ParseRows(const char *text, std::size_t length, ThreadPool &pool)
+{
+    NN_METRIC_TIMER("parse");
+    NN_METRIC_COUNT("parsed_bytes", length);
+    std::vector<DataParser::Chunk> chunks = DataParser::ParseChunks(text, length, pool);
+
+    std::size_t numInstances = 0;
+    std::size_t numValues = 0;
+    for (const DataParser::Chunk &chunk : chunks)
+    {
+        if (chunk.numInstances == 0)
+        {
+            continue;
+        }
+        if (chunk.inconsistent || (numInstances != 0 && chunk.numValues != numValues))
+        {
+            throw std::runtime_error("Inconsistent number of values across instances");
+        }
+        numValues = chunk.numValues;
+        numInstances += chunk.numInstances;
+    }
+
+    return DataParser::Gather(chunks, numInstances, numValues, pool);
+}
+
+// Parses text as one stream of whitespace-separated values, up to the first
+// token that is not a number, and groups them into instances of groupWidth
+// values. An incomplete trailing group is dropped.
+inline Dataset ParseValueGroups(const char *text, std::size_t length, std::size_t groupWidth, ThreadPool &pool)
+{
+    NN_METRIC_TIMER("parse");
+    NN_METRIC_COUNT("parsed_bytes", length);
+    std::vector<DataParser::Chunk> chunks = DataParser::ParseChunks(text, length, pool);
+
+    // Keep the chunks up to and including the one that stopped early, and
+    // regroup their values so no group straddles two chunks
+    std::vector<DataParser::Chunk> kept(1);
+    std::vector<double> &values = kept[0].values;
+    for (const DataParser::Chunk &chunk : chunks)
+    {
+        std::size_t count = chunk.stoppedEarly ? chunk.valuesBeforeStop : chunk.values.size();
+        values.insert(values.end(), chunk.values.begin(), chunk.values.begin() + count);
+        if (chunk.stoppedEarly)
+        {
+            break;
+        }
+    }
+
+    std::size_t numInstances = values.size() / groupWidth;
+    values.resize(numInstances * groupWidth);
+    return DataParser::Gather(kept, numInstances, groupWidth, pool);
+}
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+// Hands out memory aligned to a cache line so every column of a Dataset
+// starts on a 64-byte boundary
+template <typename T>
+struct AlignedAllocator
+{
+    using value_type = T;
+    static constexpr std::size_t Alignment = 64;
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &)
+    {
+    }
+
+    T *allocate(std::size_t count)
+    {
+        return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *pointer, std::size_t)
+    {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+// A table of values stored column-major in one contiguous buffer. Each
+// column is padded to a whole number of cache lines, so a feature subset is
+// read as a handful of dense, aligned arrays instead of one pointer per row.
+// Dataset holds doubles; narrower value types hold reduced-precision copies.
+//
+// The buffer may also be borrowed from memory the Dataset does not own, such
+// as a mapped cache file. Reads go straight to that memory; the first write
+// copies it into a buffer of the Dataset's own.
+template <typename T>
+class BasicDataset
+{
+private:
+    std::size_t numInstances = 0;
+    std::size_t numColumns = 0;
+    std::size_t columnStride = 0; // numInstances rounded up to a cache line
+    std::vector<T, AlignedAllocator<T>> values;
+    const T *borrowed = nullptr;               // Borrowed columns, if any
+    std::shared_ptr<const void> borrowedOwner; // Keeps the borrowed memory alive
+
+    const T *base() const
+    {
+        return borrowed != nullptr ? borrowed : values.data();
+    }
+
+    void makeOwned()
+    {
+        if (borrowed != nullptr)
+        {
+            values.assign(borrowed, borrowed + columnStride * numColumns);
+            borrowed = nullptr;
+            borrowedOwner.reset();
+        }
+    }
+
+public:
+    static constexpr std::size_t ValuesPerCacheLine = AlignedAllocator<T>::Alignment / sizeof(T);
+
+    BasicDataset() = default;
+
+    BasicDataset(std::size_t numInstances, std::size_t numColumns)
+        : numInstances(numInstances), numColumns(numColumns),
+          columnStride(StrideFor(numInstances)),
+          values(columnStride * numColumns, T())
+    {
+    }
+
+    // Builds a dataset from values laid out one instance after another
+    static BasicDataset FromRowMajor(const std::vector<T> &rowMajorValues,
+                                     std::size_t numInstances, std::size_t numColumns)
+    {
+        if (rowMajorValues.size() != numInstances * numColumns)
+        {
+            throw std::runtime_error("Row-major values do not match the dataset dimensions");
+        }
+
+        BasicDataset dataset(numInstances, numColumns);
+        for (std::size_t i = 0; i < numInstances; i++)
+        {
+            for (std::size_t j = 0; j < numColumns; j++)
+            {
+                dataset.at(i, j) = rowMajorValues[i * numColumns + j];
+            }
+        }
+        return dataset;
+    }
+
+    // Wraps columns laid out exactly as a Dataset lays them out (columnStride
+    // values apart, starting on a cache line) without copying them. owner
+    // must keep the memory alive; it is shared by every copy of the Dataset.
+    static BasicDataset Borrow(const T *columns, std::size_t numInstances, std::size_t numColumns,
+                               std::shared_ptr<const void> owner)
+    {
+        BasicDataset dataset;
+        dataset.numInstances = numInstances;
+        dataset.numColumns = numColumns;
+        dataset.columnStride = StrideFor(numInstances);
+        dataset.borrowed = columns;
+        dataset.borrowedOwner = std::move(owner);
+        return dataset;
+    }
+
+    // Distance in values between the starts of consecutive columns
+    static std::size_t StrideFor(std::size_t numInstances)
+    {
+        return (numInstances + ValuesPerCacheLine - 1) / ValuesPerCacheLine * ValuesPerCacheLine;
+    }
+
+    std::size_t getNumInstances() const
+    {
+        return numInstances;
+    }
+
+    std::size_t getNumColumns() const
+    {
+        return numColumns;
+    }
+
+    bool empty() const
+    {
+        return numInstances == 0;
+    }
+
+    std::size_t getColumnStride() const
+    {
+        return columnStride;
+    }
+
+    bool isBorrowed() const
+    {
+        return borrowed != nullptr;
+    }
+
+    const T *column(std::size_t j) const
+    {
+        return base() + j * columnStride;
+    }
+
+    T *column(std::size_t j)
+    {
+        makeOwned();
+        return values.data() + j * columnStride;
+    }
+
+    T at(std::size_t i, std::size_t j) const
+    {
+        return base()[j * columnStride + i];
+    }
+
+    T &at(std::size_t i, std::size_t j)
+    {
+        makeOwned();
+        return values[j * columnStride + i];
+    }
+
+    // Gathers one instance into a row vector
+    std::vector<T> row(std::size_t i) const
+    {
+        std::vector<T> instance(numColumns);
+        for (std::size_t j = 0; j < numColumns; j++)
+        {
+            instance[j] = at(i, j);
+        }
+        return instance;
+    }
+
+    // Drops a column; the remaining columns keep their alignment
+    void removeColumn(std::size_t j)
+    {
+        if (j >= numColumns)
+        {
+            throw std::out_of_range("Column index out of range");
+        }
+        makeOwned();
+        values.erase(values.begin() + j * columnStride, values.begin() + (j + 1) * columnStride);
+        numColumns--;
+    }
+};
+
+using Dataset = BasicDataset<double>;
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef DATASET_CACHE_H
+#define DATASET_CACHE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "Dataset.h"
+#include "DataParser.h"
+#include "Metrics.h"
+
+// Labels and min-max normalized feature columns, ready for evaluation
+struct PreparedDataset
+{
+    Dataset features; // Each column scaled to [0, 1]; constant columns are left as read
+    std::vector<int> labels;
+    std::vector<double> minimums; // Of each raw feature column
+    std::vector<double> maximums;
+};
+
+// Scales every column to [0, 1] by its minimum and maximum, recording them.
+// A constant column cannot be scaled and keeps its raw values.
+inline Dataset NormalizeColumns(const Dataset &data, std::vector<double> *minimums = nullptr,
+                                std::vector<double> *maximums = nullptr)
+{
+    NN_METRIC_TIMER("normalize");
+    Dataset normalizedData = data;
+    std::size_t numInstances = data.getNumInstances();
+    std::size_t numFeatures = data.getNumColumns();
+
+    for (std::size_t j = 0; j < numFeatures; ++j)
+    {
+        const double *source = data.column(j);
+        double *destination = normalizedData.column(j);
+        double minVal = source[0];
+        double maxVal = source[0];
+
+        for (std::size_t i = 0; i < numInstances; ++i)
+        {
+            minVal = std::min(minVal, source[i]);
+            maxVal = std::max(maxVal, source[i]);
+        }
+
+        if (maxVal > minVal)
+        {
+            for (std::size_t i = 0; i < numInstances; ++i)
+            {
+                destination[i] = (source[i] - minVal) / (maxVal - minVal);
+            }
+        }
+
+        if (minimums != nullptr)
+        {
+            minimums->push_back(minVal);
+        }
+        if (maximums != nullptr)
+        {
+            maximums->push_back(maxVal);
+        }
+    }
+    return normalizedData;
+}
+
+// Splits the class labels off the first column and normalizes the rest
+inline PreparedDataset PrepareDataset(Dataset data)
+{
+    PreparedDataset prepared;
+    const double *labelColumn = static_cast<const Dataset &>(data).column(0);
+    for (std::size_t i = 0; i < data.getNumInstances(); i++)
+    {
+        prepared.labels.push_back(static_cast<int>(labelColumn[i]));
+    }
+    data.removeColumn(0);
+    prepared.features = NormalizeColumns(data, &prepared.minimums, &prepared.maximums);
+    return prepared;
+}
+
+// Checksum of a source file's bytes: FNV-1a over 64-bit words, in four
+// interleaved lanes so the multiplies do not wait on one another. Bytes may
+// be fed in pieces of any size; the result only depends on their sequence.
+class SourceChecksum
+{
+private:
+    static constexpr std::uint64_t OffsetBasis = 14695981039346656037ull;
+    static constexpr std::uint64_t Prime = 1099511628211ull;
+    static constexpr std::size_t BlockBytes = 32; // One word per lane
+
+    std::uint64_t lanes[4] = {OffsetBasis, OffsetBasis ^ 1, OffsetBasis ^ 2, OffsetBasis ^ 3};
+    char pending[BlockBytes]; // Bytes of an incomplete block
+    std::size_t numPending = 0;
+    std::uint64_t length = 0;
+
+    void addBlock(const char *block)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, block + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * Prime;
+        }
+    }
+
+public:
+    void update(const char *bytes, std::size_t count)
+    {
+        length += count;
+        if (numPending > 0)
+        {
+            std::size_t taken = std::min(count, BlockBytes - numPending);
+            std::memcpy(pending + numPending, bytes, taken);
+            numPending += taken;
+            bytes += taken;
+            count -= taken;
+            if (numPending < BlockBytes)
+            {
+                return;
+            }
+            addBlock(pending);
+            numPending = 0;
+        }
+        for (; count >= BlockBytes; bytes += BlockBytes, count -= BlockBytes)
+        {
+            addBlock(bytes);
+        }
+        std::memcpy(pending, bytes, count);
+        numPending = count;
+    }
+
+    std::uint64_t value() const
+    {
+        std::uint64_t hash = OffsetBasis;
+        for (std::uint64_t lane : lanes)
+        {
+            hash = (hash ^ lane) * Prime;
+        }
+        for (std::size_t i = 0; i < numPending; i++)
+        {
+            hash = (hash ^ static_cast<unsigned char>(pending[i])) * Prime;
+        }
+        return (hash ^ length) * Prime;
+    }
+};
+
+inline std::uint64_t ChecksumBytes(const char *bytes, std::size_t length)
+{
+    SourceChecksum checksum;
+    checksum.update(bytes, length);
+    return checksum.value();
+}
+
+// A prepared dataset stored next to its source text file, so later runs
+// can skip parsing and normalizing it. The file is a fixed header followed
+// by the labels, the per-column minimums and maximums, and the normalized
+// columns, each section starting on a cache line. The columns use the
+// Dataset layout, so a mapped cache is used in place without copying.
+namespace DatasetCache
+{
+    constexpr char Magic[8] = {'N', 'N', 'D', 'S', 'E', 'T', '\r', '\n'};
+    constexpr std::uint32_t Version = 1;
+    constexpr std::size_t SectionAlignment = 64;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t groupWidth; // How the source was parsed; 0 for one instance per line
+        std::uint64_t sourceSize;
+        std::uint64_t sourceChecksum;
+        std::uint64_t numInstances;
+        std::uint64_t numColumns;
+        std::uint64_t columnStride;
+        std::uint64_t labelsOffset;
+        std::uint64_t boundsOffset; // Minimums, then maximums
+        std::uint64_t columnsOffset;
+        std::uint64_t fileSize;
+    };
+
+    inline std::uint64_t AlignSection(std::uint64_t offset)
+    {
+        return (offset + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+    }
+
+    // Where the cache for a source file lives
+    inline std::string PathFor(const std::string &sourcePath)
+    {
+        return sourcePath + ".cache";
+    }
+
+    // A name next to path to write a new file under before renaming it into
+    // place. It holds the process id and a per-process count, so processes
+    // (or threads) building the same file never write into each other's.
+    inline std::string TemporaryPathFor(const std::string &path)
+    {
+        static std::atomic<std::uint64_t> counter{0};
+#ifdef DATA_PARSER_HAS_MMAP
+        static const std::uint64_t process = static_cast<std::uint64_t>(getpid());
+#else
+        static const std::uint64_t process = std::random_device{}();
+#endif
+        return path + "." + std::to_string(process) + "." + std::to_string(counter.fetch_add(1)) + ".tmp";
+    }
+
+    // Fills in the section offsets for a dataset of the given shape
+    inline Header Layout(std::uint64_t numInstances, std::uint64_t numColumns)
+    {
+        Header header = {};
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.numInstances = numInstances;
+        header.numColumns = numColumns;
+        header.columnStride = Dataset::StrideFor(numInstances);
+        header.labelsOffset = AlignSection(sizeof(Header));
+        header.boundsOffset = AlignSection(header.labelsOffset + numInstances * sizeof(std::int32_t));
+        header.columnsOffset = AlignSection(header.boundsOffset + 2 * numColumns * sizeof(double));
+        header.fileSize = header.columnsOffset + numColumns * header.columnStride * sizeof(double);
+        return header;
+    }
+
+    // Whether header was written by this version and describes a complete
+    // file of fileSize bytes
+    inline bool IsIntact(const Header &header, std::uint64_t fileSize)
+    {
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version)
+        {
+            return false;
+        }
+        Header expected = Layout(header.numInstances, header.numColumns);
+        return header.columnStride == expected.columnStride && header.labelsOffset == expected.labelsOffset &&
+               header.boundsOffset == expected.boundsOffset && header.columnsOffset == expected.columnsOffset &&
+               header.fileSize == expected.fileSize && fileSize == header.fileSize;
+    }
+
+    // Maps the cache at path into prepared if it was built by this version
+    // from a source with the given size, checksum and layout. Returns false
+    // if it is missing, stale or damaged.
+    inline bool Load(const std::string &path, std::uint64_t sourceSize, std::uint64_t sourceChecksum,
+                     std::uint32_t groupWidth, PreparedDataset &prepared)
+    {
+        std::shared_ptr<MappedFile> file;
+        try
+        {
+            file = std::make_shared<MappedFile>(path);
+        }
+        catch (const std::runtime_error &)
+        {
+            return false;
+        }
+
+        Header header;
+        if (file->size() < sizeof(Header))
+        {
+            return false;
+        }
+        std::memcpy(&header, file->data(), sizeof(Header));
+        if (!IsIntact(header, file->size()) || header.groupWidth != groupWidth ||
+            header.sourceSize != sourceSize || header.sourceChecksum != sourceChecksum)
+        {
+            return false;
+        }
+
+        std::size_t numInstances = static_cast<std::size_t>(header.numInstances);
+        std::size_t numColumns = static_cast<std::size_t>(header.numColumns);
+        const std::int32_t *labels = reinterpret_cast<const std::int32_t *>(file->data() + header.labelsOffset);
+        const double *bounds = reinterpret_cast<const double *>(file->data() + header.boundsOffset);
+        const double *columns = reinterpret_cast<const double *>(file->data() + header.columnsOffset);
+
+        prepared.labels.assign(labels, labels + numInstances);
+        prepared.minimums.assign(bounds, bounds + numColumns);
+        prepared.maximums.assign(bounds + numColumns, bounds + 2 * numColumns);
+        prepared.features = Dataset::Borrow(columns, numInstances, numColumns, file);
+        return true;
+    }
+
+    // Writes prepared to path, replacing any cache already there. The file
+    // is written under a temporary name first, so a run reading the cache
+    // at the same time never sees half of it. Returns false on failure.
+    inline bool Store(const std::string &path, std::uint64_t sourceSize, std::uint64_t sourceChecksum,
+                      std::uint32_t groupWidth, const PreparedDataset &prepared)
+    {
+        const Dataset &features = prepared.features;
+        Header header = Layout(features.getNumInstances(), features.getNumColumns());
+        header.groupWidth = groupWidth;
+        header.sourceSize = sourceSize;
+        header.sourceChecksum = sourceChecksum;
+
+        std::vector<char> bytes(header.fileSize, 0);
+        std::memcpy(bytes.data(), &header, sizeof(Header));
+        for (std::size_t i = 0; i < prepared.labels.size(); i++)
+        {
+            std::int32_t label = prepared.labels[i];
+            std::memcpy(bytes.data() + header.labelsOffset + i * sizeof(label), &label, sizeof(label));
+        }
+        std::memcpy(bytes.data() + header.boundsOffset, prepared.minimums.data(),
+                    prepared.minimums.size() * sizeof(double));
+        std::memcpy(bytes.data() + header.boundsOffset + header.numColumns * sizeof(double),
+                    prepared.maximums.data(), prepared.maximums.size() * sizeof(double));
+        for (std::size_t j = 0; j < features.getNumColumns(); j++)
+        {
+            std::memcpy(bytes.data() + header.columnsOffset + j * header.columnStride * sizeof(double),
+                        features.column(j), features.getNumInstances() * sizeof(double));
+        }
+
+        std::string temporaryPath = TemporaryPathFor(path);
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.write(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+            {
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        return true;
+    }
+}
+
+// Parses a source file into a PreparedDataset, going through its cache:
+// a cache built from identical bytes is mapped instead of parsing, and a
+// missing or stale one is rebuilt. groupWidth 0 reads one instance per
+// line; otherwise the file is one stream of values grouped that many at a
+// time. Returns an empty dataset if the file holds no instances.
+inline PreparedDataset LoadPreparedDataset(const std::string &path, std::size_t groupWidth,
+                                           bool useCache, ThreadPool &pool)
+{
+    NN_METRIC_TIMER("load_dataset");
+    MappedFile source(path);
+    std::uint64_t checksum = ChecksumBytes(source.data(), source.size());
+    std::string cachePath = DatasetCache::PathFor(path);
+    std::uint32_t layout = static_cast<std::uint32_t>(groupWidth);
+
+    PreparedDataset prepared;
+    if (useCache && DatasetCache::Load(cachePath, source.size(), checksum, layout, prepared))
+    {
+        NN_METRIC_COUNT("dataset_cache_hits", 1);
+        return prepared;
+    }
+
+    Dataset data = groupWidth == 0 ? ParseRows(source.data(), source.size(), pool)
+                                   : ParseValueGroups(source.data(), source.size(), groupWidth, pool);
+    if (data.empty())
+    {
+        return prepared;
+    }
+    prepared = PrepareDataset(std::move(data));
+    if (useCache)
+    {
+        // A cache that cannot be written only costs the next run a re-parse
+        DatasetCache::Store(cachePath, source.size(), checksum, layout, prepared);
+    }
+    return prepared;
+}
+
+#endif
@@ -0,0 +1,738 @@
+#ifndef DISTANCE_KERNELS_H
+#define DISTANCE_KERNELS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "Dataset.h"
+#include "Metrics.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DISTANCE_KERNELS_X86 1
+#endif
+
+// Nearest-neighbor scans over the columns of a Dataset. Every kernel sums the
+// squared differences feature by feature in the same order, without fused
+// multiply-adds, so all of them produce bit-identical distances and agree on
+// ties: the lowest row index among equally near rows wins, just like a
+// sequential scan with a strict "<" comparison.
+//
+// Columns may also be stored as float or int16_t to cut memory traffic.
+// Their values are widened to double as they are loaded, so only the storage
+// is narrower; the arithmetic, and with it the tie-breaking, is unchanged.
+
+// The columns a scan reads; features == nullptr selects columns 0..numFeatures-1
+template <typename T>
+struct BasicColumnSelection
+{
+    const BasicDataset<T> *data;
+    const std::size_t *features;
+    std::size_t numFeatures;
+
+    const T *column(std::size_t j) const
+    {
+        return data->column(features == nullptr ? j : features[j]);
+    }
+};
+
+using ColumnSelection = BasicColumnSelection<double>;
+
+// Result of a scan; index is NoNeighbor when every row was excluded
+struct NeighborMatch
+{
+    static constexpr std::size_t NoNeighbor = std::numeric_limits<std::size_t>::max();
+
+    double distance = std::numeric_limits<double>::max();
+    std::size_t index = NoNeighbor;
+};
+
+enum class DistanceKernel
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Work done by early-abandoning scans. A dimension operation is one squared
+// difference added into one row's distance.
+struct ScanCounters
+{
+    std::uint64_t dimensionOperations = 0; // What a full scan would have done
+    std::uint64_t dimensionsSkipped = 0;   // Saved by abandoning rows early
+
+    ScanCounters &operator+=(const ScanCounters &other)
+    {
+        dimensionOperations += other.dimensionOperations;
+        dimensionsSkipped += other.dimensionsSkipped;
+        return *this;
+    }
+};
+
+// Finds the row nearest to query (one value per selected column), skipping
+// the row at index excluded. With EarlyAbandon a row stops accumulating as
+// soon as its partial distance reaches the best so far: squares are never
+// negative, so it can no longer be strictly nearer.
+template <bool EarlyAbandon, typename T>
+inline NeighborMatch FindNearestScalar(const BasicColumnSelection<T> &selection, const double *query,
+                                       std::size_t excluded, ScanCounters *counters)
+{
+    NeighborMatch best;
+    std::size_t numInstances = selection.data->getNumInstances();
+    std::uint64_t skipped = 0;
+
+    for (std::size_t i = 0; i < numInstances; i++)
+    {
+        if (i == excluded)
+        {
+            continue;
+        }
+
+        double distance = 0.0;
+        std::size_t j = 0;
+        for (; j < selection.numFeatures; j++)
+        {
+            double difference = query[j] - static_cast<double>(selection.column(j)[i]);
+            distance += difference * difference;
+            if (EarlyAbandon && distance >= best.distance)
+            {
+                break;
+            }
+        }
+
+        if (EarlyAbandon && j < selection.numFeatures)
+        {
+            skipped += selection.numFeatures - j - 1;
+            continue;
+        }
+
+        if (distance < best.distance)
+        {
+            best.distance = distance;
+            best.index = i;
+        }
+    }
+
+    if (EarlyAbandon)
+    {
+        std::size_t scannedRows = numInstances - (excluded < numInstances ? 1 : 0);
+        counters->dimensionOperations += static_cast<std::uint64_t>(scannedRows) * selection.numFeatures;
+        counters->dimensionsSkipped += skipped;
+    }
+    return best;
+}
+
+// Adds sign * (column[i] - column[k])^2 to row[k] for k in [begin, end),
+// which grows (sign = 1) or shrinks (sign = -1) row i of a pairwise
+// distance matrix by one feature, and lowers rowMin to the smallest of
+// the updated entries
+inline void AccumulateRangeScalar(double *row, const double *column, std::size_t i, double sign, std::size_t begin,
+                                  std::size_t end, double &rowMin)
+{
+    for (std::size_t k = begin; k < end; k++)
+    {
+        double difference = column[i] - column[k];
+        row[k] += sign * difference * difference;
+        if (row[k] < rowMin)
+        {
+            rowMin = row[k];
+        }
+    }
+}
+
+// Appends to indices, in ascending order, every k in [begin, end) with
+// values[k] <= limit
+inline void CollectWithinScalar(const double *values, std::size_t begin, std::size_t end, double limit,
+                                std::vector<std::size_t> &indices)
+{
+    for (std::size_t k = begin; k < end; k++)
+    {
+        if (values[k] <= limit)
+        {
+            indices.push_back(k);
+        }
+    }
+}
+
+// Squared distances from query to the rows [begin, begin + count) of the
+// columns, written to distances[0, count) and summed like the scans
+inline void BlockDistancesScalar(const double *const *columns, std::size_t numFeatures, const double *query,
+                                 std::size_t begin, std::size_t count, double *distances)
+{
+    for (std::size_t r = 0; r < count; r++)
+    {
+        double distance = 0.0;
+        for (std::size_t j = 0; j < numFeatures; j++)
+        {
+            double difference = query[j] - columns[j][begin + r];
+            distance += difference * difference;
+        }
+        distances[r] = distance;
+    }
+}
+
+#ifdef DISTANCE_KERNELS_X86
+
+// GCC 12 intrinsic-header false positive: AVX-512 conversions and
+// reductions start from undefined registers it then reports as uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// Four (or eight) consecutive values of a column, widened to double. The
+// loads are aligned: blocks start at multiples of four (eight) rows and
+// columns start on a cache line.
+__attribute__((target("avx2"))) inline __m256d LoadFourAsDouble(const double *values)
+{
+    return _mm256_load_pd(values);
+}
+
+__attribute__((target("avx2"))) inline __m256d LoadFourAsDouble(const float *values)
+{
+    return _mm256_cvtps_pd(_mm_load_ps(values));
+}
+
+__attribute__((target("avx2"))) inline __m256d LoadFourAsDouble(const std::int16_t *values)
+{
+    return _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(values))));
+}
+
+__attribute__((target("avx512f"))) inline __m512d LoadEightAsDouble(const double *values)
+{
+    return _mm512_load_pd(values);
+}
+
+__attribute__((target("avx512f"))) inline __m512d LoadEightAsDouble(const float *values)
+{
+    return _mm512_cvtps_pd(_mm256_load_ps(values));
+}
+
+__attribute__((target("avx512f"))) inline __m512d LoadEightAsDouble(const std::int16_t *values)
+{
+    return _mm512_cvtepi32_pd(_mm256_cvtepi16_epi32(_mm_load_si128(reinterpret_cast<const __m128i *>(values))));
+}
+
+// Four rows at a time. Columns are padded to whole cache lines, so the last
+// block can read past the final row; those lanes are masked to infinity.
+// With EarlyAbandon a block stops once none of its rows can beat the best
+// distance found in earlier blocks. Those rows all have higher indices, so
+// a tie would not have won either.
+template <bool EarlyAbandon, typename T>
+__attribute__((target("avx2"), optimize("fp-contract=off"))) inline NeighborMatch
+FindNearestAVX2(const BasicColumnSelection<T> &selection, const double *query, std::size_t excluded, ScanCounters *counters)
+{
+    const std::size_t numInstances = selection.data->getNumInstances();
+    const __m256d infinity = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d laneStep = _mm256_set1_pd(4.0);
+    __m256d bestDistances = _mm256_set1_pd(std::numeric_limits<double>::max());
+    __m256d bestIndices = _mm256_set1_pd(-1.0);
+    __m256d rowIndices = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+    const __m256d excludedIndex = _mm256_set1_pd(static_cast<double>(excluded));
+    const __m256d rowLimit = _mm256_set1_pd(static_cast<double>(numInstances));
+    double bestSoFar = std::numeric_limits<double>::max();
+    std::uint64_t skipped = 0;
+
+    for (std::size_t block = 0; block < numInstances; block += 4)
+    {
+        __m256d skippedLanes = _mm256_or_pd(_mm256_cmp_pd(rowIndices, excludedIndex, _CMP_EQ_OQ),
+                                            _mm256_cmp_pd(rowIndices, rowLimit, _CMP_GE_OQ));
+        __m256d distances = _mm256_setzero_pd();
+        bool abandoned = false;
+        for (std::size_t j = 0; j < selection.numFeatures; j++)
+        {
+            __m256d differences = _mm256_sub_pd(_mm256_set1_pd(query[j]), LoadFourAsDouble(selection.column(j) + block));
+            distances = _mm256_add_pd(distances, _mm256_mul_pd(differences, differences));
+            if (EarlyAbandon && _mm256_movemask_pd(_mm256_cmp_pd(distances, _mm256_set1_pd(bestSoFar), _CMP_LT_OQ)) == 0)
+            {
+                int eligibleLanes = 4 - __builtin_popcount(_mm256_movemask_pd(skippedLanes));
+                skipped += static_cast<std::uint64_t>(selection.numFeatures - j - 1) * eligibleLanes;
+                abandoned = true;
+                break;
+            }
+        }
+
+        if (!abandoned)
+        {
+            distances = _mm256_blendv_pd(distances, infinity, skippedLanes);
+            __m256d closer = _mm256_cmp_pd(distances, bestDistances, _CMP_LT_OQ);
+            bestDistances = _mm256_blendv_pd(bestDistances, distances, closer);
+            bestIndices = _mm256_blendv_pd(bestIndices, rowIndices, closer);
+            if (EarlyAbandon)
+            {
+                __m256d pairMin = _mm256_min_pd(bestDistances, _mm256_permute2f128_pd(bestDistances, bestDistances, 1));
+                pairMin = _mm256_min_pd(pairMin, _mm256_permute_pd(pairMin, 5));
+                bestSoFar = _mm256_cvtsd_f64(pairMin);
+            }
+        }
+        rowIndices = _mm256_add_pd(rowIndices, laneStep);
+    }
+
+    alignas(32) double laneDistances[4];
+    alignas(32) double laneIndices[4];
+    _mm256_store_pd(laneDistances, bestDistances);
+    _mm256_store_pd(laneIndices, bestIndices);
+
+    NeighborMatch best;
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (laneIndices[lane] < 0.0)
+        {
+            continue;
+        }
+        std::size_t index = static_cast<std::size_t>(laneIndices[lane]);
+        if (laneDistances[lane] < best.distance || (laneDistances[lane] == best.distance && index < best.index))
+        {
+            best.distance = laneDistances[lane];
+            best.index = index;
+        }
+    }
+
+    if (EarlyAbandon)
+    {
+        std::size_t scannedRows = numInstances - (excluded < numInstances ? 1 : 0);
+        counters->dimensionOperations += static_cast<std::uint64_t>(scannedRows) * selection.numFeatures;
+        counters->dimensionsSkipped += skipped;
+    }
+    return best;
+}
+
+// Eight rows at a time; a column stride is always a multiple of eight
+template <bool EarlyAbandon, typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=off"))) inline NeighborMatch
+FindNearestAVX512(const BasicColumnSelection<T> &selection, const double *query, std::size_t excluded, ScanCounters *counters)
+{
+    const std::size_t numInstances = selection.data->getNumInstances();
+    __m512d bestDistances = _mm512_set1_pd(std::numeric_limits<double>::max());
+    __m512i bestIndices = _mm512_set1_epi64(-1);
+    __m512i rowIndices = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m512i laneStep = _mm512_set1_epi64(8);
+    const __m512i excludedIndex = _mm512_set1_epi64(static_cast<long long>(excluded));
+    const __m512i rowLimit = _mm512_set1_epi64(static_cast<long long>(numInstances));
+    __m512d bestSoFar = bestDistances;
+    std::uint64_t skipped = 0;
+
+    for (std::size_t block = 0; block < numInstances; block += 8)
+    {
+        __mmask8 eligible = _mm512_cmplt_epi64_mask(rowIndices, rowLimit) &
+                            _mm512_cmpneq_epi64_mask(rowIndices, excludedIndex);
+        __m512d distances = _mm512_setzero_pd();
+        bool abandoned = false;
+        for (std::size_t j = 0; j < selection.numFeatures; j++)
+        {
+            __m512d differences = _mm512_sub_pd(_mm512_set1_pd(query[j]), LoadEightAsDouble(selection.column(j) + block));
+            distances = _mm512_add_pd(distances, _mm512_mul_pd(differences, differences));
+            if (EarlyAbandon && _mm512_mask_cmp_pd_mask(eligible, distances, bestSoFar, _CMP_LT_OQ) == 0)
+            {
+                skipped += static_cast<std::uint64_t>(selection.numFeatures - j - 1) * __builtin_popcount(eligible);
+                abandoned = true;
+                break;
+            }
+        }
+
+        if (!abandoned)
+        {
+            __mmask8 closer = _mm512_mask_cmp_pd_mask(eligible, distances, bestDistances, _CMP_LT_OQ);
+            bestDistances = _mm512_mask_mov_pd(bestDistances, closer, distances);
+            bestIndices = _mm512_mask_mov_epi64(bestIndices, closer, rowIndices);
+            if (EarlyAbandon)
+            {
+                bestSoFar = _mm512_set1_pd(_mm512_reduce_min_pd(bestDistances));
+            }
+        }
+        rowIndices = _mm512_add_epi64(rowIndices, laneStep);
+    }
+
+    alignas(64) double laneDistances[8];
+    alignas(64) long long laneIndices[8];
+    _mm512_store_pd(laneDistances, bestDistances);
+    _mm512_store_si512(laneIndices, bestIndices);
+
+    NeighborMatch best;
+    for (int lane = 0; lane < 8; lane++)
+    {
+        if (laneIndices[lane] < 0)
+        {
+            continue;
+        }
+        std::size_t index = static_cast<std::size_t>(laneIndices[lane]);
+        if (laneDistances[lane] < best.distance || (laneDistances[lane] == best.distance && index < best.index))
+        {
+            best.distance = laneDistances[lane];
+            best.index = index;
+        }
+    }
+
+    if (EarlyAbandon)
+    {
+        std::size_t scannedRows = numInstances - (excluded < numInstances ? 1 : 0);
+        counters->dimensionOperations += static_cast<std::uint64_t>(scannedRows) * selection.numFeatures;
+        counters->dimensionsSkipped += skipped;
+    }
+    return best;
+}
+
+// AccumulateRangeScalar four (or eight) entries at a time. Matrix rows
+// start anywhere, so these loads are unaligned, and the last few entries
+// are left to the scalar loop. The same operations in the same order give
+// the same bits, and a minimum does not depend on the order it is taken in.
+__attribute__((target("avx2"), optimize("fp-contract=off"))) inline void
+AccumulateRangeAVX2(double *row, const double *column, std::size_t i, double sign, std::size_t begin,
+                    std::size_t end, double &rowMin)
+{
+    const __m256d center = _mm256_set1_pd(column[i]);
+    const __m256d signs = _mm256_set1_pd(sign);
+    __m256d minimums = _mm256_set1_pd(rowMin);
+    std::size_t k = begin;
+    for (; k + 4 <= end; k += 4)
+    {
+        __m256d differences = _mm256_sub_pd(center, _mm256_loadu_pd(column + k));
+        __m256d updated = _mm256_add_pd(_mm256_loadu_pd(row + k),
+                                        _mm256_mul_pd(_mm256_mul_pd(signs, differences), differences));
+        _mm256_storeu_pd(row + k, updated);
+        minimums = _mm256_min_pd(minimums, updated);
+    }
+    __m256d pairMin = _mm256_min_pd(minimums, _mm256_permute2f128_pd(minimums, minimums, 1));
+    pairMin = _mm256_min_pd(pairMin, _mm256_permute_pd(pairMin, 5));
+    rowMin = _mm256_cvtsd_f64(pairMin);
+    AccumulateRangeScalar(row, column, i, sign, k, end, rowMin);
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off"))) inline void
+AccumulateRangeAVX512(double *row, const double *column, std::size_t i, double sign, std::size_t begin,
+                      std::size_t end, double &rowMin)
+{
+    const __m512d center = _mm512_set1_pd(column[i]);
+    const __m512d signs = _mm512_set1_pd(sign);
+    __m512d minimums = _mm512_set1_pd(rowMin);
+    std::size_t k = begin;
+    for (; k + 8 <= end; k += 8)
+    {
+        __m512d differences = _mm512_sub_pd(center, _mm512_loadu_pd(column + k));
+        __m512d updated = _mm512_add_pd(_mm512_loadu_pd(row + k),
+                                        _mm512_mul_pd(_mm512_mul_pd(signs, differences), differences));
+        _mm512_storeu_pd(row + k, updated);
+        minimums = _mm512_min_pd(minimums, updated);
+    }
+    rowMin = _mm512_reduce_min_pd(minimums);
+    AccumulateRangeScalar(row, column, i, sign, k, end, rowMin);
+}
+
+// BlockDistancesScalar four (or eight) rows at a time, two groups per pass
+// over the columns; the last few rows are left to the scalar loop
+__attribute__((target("avx2"), optimize("fp-contract=off"))) inline void
+BlockDistancesAVX2(const double *const *columns, std::size_t numFeatures, const double *query, std::size_t begin,
+                   std::size_t count, double *distances)
+{
+    std::size_t r = 0;
+    for (; r + 8 <= count; r += 8)
+    {
+        __m256d first = _mm256_setzero_pd();
+        __m256d second = _mm256_setzero_pd();
+        for (std::size_t j = 0; j < numFeatures; j++)
+        {
+            const __m256d value = _mm256_set1_pd(query[j]);
+            __m256d differences = _mm256_sub_pd(value, _mm256_loadu_pd(columns[j] + begin + r));
+            first = _mm256_add_pd(first, _mm256_mul_pd(differences, differences));
+            differences = _mm256_sub_pd(value, _mm256_loadu_pd(columns[j] + begin + r + 4));
+            second = _mm256_add_pd(second, _mm256_mul_pd(differences, differences));
+        }
+        _mm256_storeu_pd(distances + r, first);
+        _mm256_storeu_pd(distances + r + 4, second);
+    }
+    BlockDistancesScalar(columns, numFeatures, query, begin + r, count - r, distances + r);
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off"))) inline void
+BlockDistancesAVX512(const double *const *columns, std::size_t numFeatures, const double *query, std::size_t begin,
+                     std::size_t count, double *distances)
+{
+    std::size_t r = 0;
+    for (; r + 16 <= count; r += 16)
+    {
+        __m512d first = _mm512_setzero_pd();
+        __m512d second = _mm512_setzero_pd();
+        for (std::size_t j = 0; j < numFeatures; j++)
+        {
+            const __m512d value = _mm512_set1_pd(query[j]);
+            __m512d differences = _mm512_sub_pd(value, _mm512_loadu_pd(columns[j] + begin + r));
+            first = _mm512_add_pd(first, _mm512_mul_pd(differences, differences));
+            differences = _mm512_sub_pd(value, _mm512_loadu_pd(columns[j] + begin + r + 8));
+            second = _mm512_add_pd(second, _mm512_mul_pd(differences, differences));
+        }
+        _mm512_storeu_pd(distances + r, first);
+        _mm512_storeu_pd(distances + r + 8, second);
+    }
+    BlockDistancesScalar(columns, numFeatures, query, begin + r, count - r, distances + r);
+}
+
+// CollectWithinScalar with one comparison per four (or eight) values;
+// usually none of them qualifies and the block is passed over at once
+__attribute__((target("avx2"))) inline void CollectWithinAVX2(const double *values, std::size_t count, double limit,
+                                                              std::vector<std::size_t> &indices)
+{
+    const __m256d limits = _mm256_set1_pd(limit);
+    std::size_t k = 0;
+    for (; k + 4 <= count; k += 4)
+    {
+        int within = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + k), limits, _CMP_LE_OQ));
+        for (; within != 0; within &= within - 1)
+        {
+            indices.push_back(k + static_cast<std::size_t>(__builtin_ctz(within)));
+        }
+    }
+    CollectWithinScalar(values, k, count, limit, indices);
+}
+
+__attribute__((target("avx512f"))) inline void CollectWithinAVX512(const double *values, std::size_t count, double limit,
+                                                                   std::vector<std::size_t> &indices)
+{
+    const __m512d limits = _mm512_set1_pd(limit);
+    std::size_t k = 0;
+    for (; k + 8 <= count; k += 8)
+    {
+        unsigned within = _mm512_cmp_pd_mask(_mm512_loadu_pd(values + k), limits, _CMP_LE_OQ);
+        for (; within != 0; within &= within - 1)
+        {
+            indices.push_back(k + static_cast<std::size_t>(__builtin_ctz(within)));
+        }
+    }
+    CollectWithinScalar(values, k, count, limit, indices);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+// The widest kernel this CPU supports, detected once
+inline DistanceKernel DetectDistanceKernel()
+{
+#ifdef DISTANCE_KERNELS_X86
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return DistanceKernel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return DistanceKernel::AVX2;
+    }
+#endif
+    return DistanceKernel::Scalar;
+}
+
+inline bool DistanceKernelSupported(DistanceKernel kernel)
+{
+#ifdef DISTANCE_KERNELS_X86
+    switch (kernel)
+    {
+    case DistanceKernel::AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case DistanceKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+    default:
+        return true;
+    }
+#else
+    return kernel == DistanceKernel::Scalar;
+#endif
+}
+
+inline DistanceKernel &ActiveDistanceKernel()
+{
+    static DistanceKernel kernel = DetectDistanceKernel();
+    return kernel;
+}
+
+// Overrides the detected kernel, e.g. to compare against the scalar scan.
+// Returns false and keeps the current kernel if this CPU cannot run it.
+inline bool SelectDistanceKernel(DistanceKernel kernel)
+{
+    if (!DistanceKernelSupported(kernel))
+    {
+        return false;
+    }
+    ActiveDistanceKernel() = kernel;
+    return true;
+}
+
+inline const char *DistanceKernelName(DistanceKernel kernel)
+{
+    switch (kernel)
+    {
+    case DistanceKernel::AVX2:
+        return "avx2";
+    case DistanceKernel::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+template <bool EarlyAbandon, typename T>
+inline NeighborMatch FindNearestWith(const BasicColumnSelection<T> &selection, const double *query,
+                                     std::size_t excluded, ScanCounters *counters)
+{
+    NN_METRIC_COUNT("distance_rows", selection.data->getNumInstances());
+    NN_METRIC_COUNT("distance_terms", selection.data->getNumInstances() * selection.numFeatures);
+#ifdef DISTANCE_KERNELS_X86
+    switch (ActiveDistanceKernel())
+    {
+    case DistanceKernel::AVX512:
+        return FindNearestAVX512<EarlyAbandon, T>(selection, query, excluded, counters);
+    case DistanceKernel::AVX2:
+        return FindNearestAVX2<EarlyAbandon, T>(selection, query, excluded, counters);
+    default:
+        break;
+    }
+#endif
+    return FindNearestScalar<EarlyAbandon, T>(selection, query, excluded, counters);
+}
+
+// Runs the active kernel over every dimension of every row
+template <typename T>
+inline NeighborMatch FindNearest(const BasicColumnSelection<T> &selection, const double *query,
+                                 std::size_t excluded = NeighborMatch::NoNeighbor)
+{
+    return FindNearestWith<false, T>(selection, query, excluded, nullptr);
+}
+
+// Runs the active kernel, abandoning rows (or SIMD blocks of rows) whose
+// partial distance already rules them out. Returns the same neighbor as
+// FindNearest and adds the work it saved to counters.
+template <typename T>
+inline NeighborMatch FindNearestEarlyAbandon(const BasicColumnSelection<T> &selection, const double *query,
+                                             std::size_t excluded, ScanCounters &counters)
+{
+    return FindNearestWith<true, T>(selection, query, excluded, &counters);
+}
+
+// Adds sign * (column[i] - column[k])^2 to every row[k], k < count, with
+// the active kernel and returns the smallest row[k] with k != i afterwards.
+// The diagonal entry is updated too (by zero) but left out of the minimum.
+inline double AccumulateRow(double *row, const double *column, std::size_t i, double sign, std::size_t count)
+{
+    double rowMin = std::numeric_limits<double>::max();
+    double diagonal = std::numeric_limits<double>::max();
+    auto accumulate = [&](std::size_t begin, std::size_t end, double &minimum)
+    {
+#ifdef DISTANCE_KERNELS_X86
+        switch (ActiveDistanceKernel())
+        {
+        case DistanceKernel::AVX512:
+            return AccumulateRangeAVX512(row, column, i, sign, begin, end, minimum);
+        case DistanceKernel::AVX2:
+            return AccumulateRangeAVX2(row, column, i, sign, begin, end, minimum);
+        default:
+            break;
+        }
+#endif
+        AccumulateRangeScalar(row, column, i, sign, begin, end, minimum);
+    };
+    accumulate(0, i, rowMin);
+    AccumulateRangeScalar(row, column, i, sign, i, i + 1, diagonal);
+    accumulate(i + 1, count, rowMin);
+    return rowMin;
+}
+
+// Replaces indices with every k < count, ascending, with values[k] <= limit
+inline void CollectWithin(const double *values, std::size_t count, double limit, std::vector<std::size_t> &indices)
+{
+    indices.clear();
+#ifdef DISTANCE_KERNELS_X86
+    switch (ActiveDistanceKernel())
+    {
+    case DistanceKernel::AVX512:
+        return CollectWithinAVX512(values, count, limit, indices);
+    case DistanceKernel::AVX2:
+        return CollectWithinAVX2(values, count, limit, indices);
+    default:
+        break;
+    }
+#endif
+    CollectWithinScalar(values, 0, count, limit, indices);
+}
+
+inline void BlockDistances(const double *const *columns, std::size_t numFeatures, const double *query,
+                           std::size_t begin, std::size_t count, double *distances)
+{
+#ifdef DISTANCE_KERNELS_X86
+    switch (ActiveDistanceKernel())
+    {
+    case DistanceKernel::AVX512:
+        return BlockDistancesAVX512(columns, numFeatures, query, begin, count, distances);
+    case DistanceKernel::AVX2:
+        return BlockDistancesAVX2(columns, numFeatures, query, begin, count, distances);
+    default:
+        break;
+    }
+#endif
+    BlockDistancesScalar(columns, numFeatures, query, begin, count, distances);
+}
+
+// Whether a is nearer than b: by distance, then by lower row index
+inline bool NearerMatch(const NeighborMatch &a, const NeighborMatch &b)
+{
+    return a.distance < b.distance || (a.distance == b.distance && a.index < b.index);
+}
+
+// Replaces neighbors with the k rows nearest to query, nearest first and
+// ties by lowest index, skipping the row at excluded; fewer if there are
+// not k other rows. One pass: distances come a block of rows at a time
+// from the active kernel, and only rows at most as far as the farthest of
+// the k kept so far (the top of a max-heap) are looked at individually.
+// neighbors[0] is always what FindNearest returns.
+inline void FindNearestK(const ColumnSelection &selection, const double *query, std::size_t excluded, std::size_t k,
+                         std::vector<NeighborMatch> &neighbors)
+{
+    constexpr std::size_t BlockRows = 256;
+    thread_local std::vector<const double *> columns;
+    thread_local std::vector<std::size_t> within;
+    alignas(64) double distances[BlockRows];
+
+    neighbors.clear();
+    if (k == 0)
+    {
+        return;
+    }
+    columns.clear();
+    for (std::size_t j = 0; j < selection.numFeatures; j++)
+    {
+        columns.push_back(selection.column(j));
+    }
+
+    std::size_t numInstances = selection.data->getNumInstances();
+    NN_METRIC_COUNT("distance_rows", numInstances);
+    NN_METRIC_COUNT("distance_terms", numInstances * selection.numFeatures);
+    for (std::size_t begin = 0; begin < numInstances; begin += BlockRows)
+    {
+        std::size_t count = std::min(BlockRows, numInstances - begin);
+        BlockDistances(columns.data(), selection.numFeatures, query, begin, count, distances);
+        double limit = neighbors.size() < k ? std::numeric_limits<double>::infinity() : neighbors.front().distance;
+        CollectWithin(distances, count, limit, within);
+        for (std::size_t r : within)
+        {
+            NeighborMatch match;
+            match.distance = distances[r];
+            match.index = begin + r;
+            if (match.index == excluded)
+            {
+                continue;
+            }
+            if (neighbors.size() < k)
+            {
+                neighbors.push_back(match);
+                std::push_heap(neighbors.begin(), neighbors.end(), NearerMatch);
+            }
+            else if (NearerMatch(match, neighbors.front()))
+            {
+                std::pop_heap(neighbors.begin(), neighbors.end(), NearerMatch);
+                neighbors.back() = match;
+                std::push_heap(neighbors.begin(), neighbors.end(), NearerMatch);
+            }
+        }
+    }
+    std::sort_heap(neighbors.begin(), neighbors.end(), NearerMatch);
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Checks that every nearest-neighbor kernel finds the row the original
+// NearestNeighborClassifier::Test loop finds, ties included. Built and run
+// by "make check".
+//
+// The datasets are drawn from a coarse grid and padded with duplicate rows,
+// so most queries have several equally near rows and only the lowest index
+// may win. Their sizes are not multiples of four or eight, so the SIMD
+// kernels' masked last blocks run too.
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include "Dataset.h"
+#include "DistanceKernels.h"
+#include "ReducedPrecision.h"
+using namespace std;
+
+// The original Test loop over the rows other than excluded: strict "<", so
+// the first of several equally near rows is kept
+template <typename T>
+NeighborMatch ReferenceNearest(const BasicColumnSelection<T> &selection, const double *query, size_t excluded)
+{
+    NeighborMatch best;
+    for (size_t i = 0; i < selection.data->getNumInstances(); i++)
+    {
+        if (i == excluded)
+        {
+            continue;
+        }
+
+        double distance = 0.0;
+        for (size_t j = 0; j < selection.numFeatures; j++)
+        {
+            double difference = query[j] - static_cast<double>(selection.column(j)[i]);
+            distance += difference * difference;
+        }
+
+        if (distance < best.distance)
+        {
+            best.distance = distance;
+            best.index = i;
+        }
+    }
+    return best;
+}
+
+struct Checker
+{
+    size_t checks = 0;
+    size_t failures = 0;
+
+    template <typename T>
+    void expectSame(const string &kernel, const string &type, const BasicColumnSelection<T> &selection,
+                    const vector<int> &labels, const double *query, size_t excluded, const NeighborMatch &found)
+    {
+        NeighborMatch expected = ReferenceNearest(selection, query, excluded);
+        int expectedLabel = expected.index == NeighborMatch::NoNeighbor ? -1 : labels[expected.index];
+        int foundLabel = found.index == NeighborMatch::NoNeighbor ? -1 : labels[found.index];
+        checks++;
+        if (found.index != expected.index || found.distance != expected.distance || foundLabel != expectedLabel)
+        {
+            if (failures++ < 20)
+            {
+                cout << "FAIL " << kernel << " " << type << ": " << selection.data->getNumInstances() << " rows, "
+                     << selection.numFeatures << " features, excluded " << static_cast<long long>(excluded)
+                     << ": found row " << static_cast<long long>(found.index) << " at " << found.distance
+                     << " (label " << foundLabel << "), expected row " << static_cast<long long>(expected.index)
+                     << " at " << expected.distance << " (label " << expectedLabel << ")\n";
+            }
+        }
+    }
+};
+
+// Every kernel this CPU can run, with and without early abandoning
+template <typename T>
+void CheckKernels(Checker &checker, const string &type, const BasicColumnSelection<T> &selection,
+                  const vector<int> &labels, const double *query, size_t excluded)
+{
+    ScanCounters counters;
+    checker.expectSame("scalar", type, selection, labels, query, excluded,
+                       FindNearestScalar<false, T>(selection, query, excluded, nullptr));
+    checker.expectSame("scalar early-abandon", type, selection, labels, query, excluded,
+                       FindNearestScalar<true, T>(selection, query, excluded, &counters));
+#ifdef DISTANCE_KERNELS_X86
+    if (DistanceKernelSupported(DistanceKernel::AVX2))
+    {
+        checker.expectSame("avx2", type, selection, labels, query, excluded,
+                           FindNearestAVX2<false, T>(selection, query, excluded, nullptr));
+        checker.expectSame("avx2 early-abandon", type, selection, labels, query, excluded,
+                           FindNearestAVX2<true, T>(selection, query, excluded, &counters));
+    }
+    if (DistanceKernelSupported(DistanceKernel::AVX512))
+    {
+        checker.expectSame("avx512", type, selection, labels, query, excluded,
+                           FindNearestAVX512<false, T>(selection, query, excluded, nullptr));
+        checker.expectSame("avx512 early-abandon", type, selection, labels, query, excluded,
+                           FindNearestAVX512<true, T>(selection, query, excluded, &counters));
+    }
+#endif
+    // And through the dispatcher, for each kernel SelectDistanceKernel accepts
+    for (DistanceKernel kernel : {DistanceKernel::Scalar, DistanceKernel::AVX2, DistanceKernel::AVX512})
+    {
+        if (SelectDistanceKernel(kernel))
+        {
+            string name = string("dispatched ") + DistanceKernelName(kernel);
+            checker.expectSame(name, type, selection, labels, query, excluded, FindNearest(selection, query, excluded));
+            checker.expectSame(name + " early-abandon", type, selection, labels, query, excluded,
+                               FindNearestEarlyAbandon(selection, query, excluded, counters));
+        }
+    }
+    SelectDistanceKernel(DetectDistanceKernel());
+}
+
+// Queries every row against the others (leave-one-out), every row against
+// all rows (so it finds itself or an earlier duplicate at distance zero),
+// and a few grid points that are not rows
+template <typename T>
+void CheckDataset(Checker &checker, const string &type, const BasicDataset<T> &data, const vector<int> &labels,
+                  const vector<size_t> &features, const vector<vector<double>> &extraQueries)
+{
+    BasicColumnSelection<T> selection{&data, features.data(), features.size()};
+    vector<double> query(features.size());
+    for (size_t i = 0; i < data.getNumInstances(); i++)
+    {
+        for (size_t j = 0; j < features.size(); j++)
+        {
+            query[j] = static_cast<double>(selection.column(j)[i]);
+        }
+        CheckKernels(checker, type, selection, labels, query.data(), i);
+        CheckKernels(checker, type, selection, labels, query.data(), NeighborMatch::NoNeighbor);
+    }
+    for (const vector<double> &extra : extraQueries)
+    {
+        CheckKernels(checker, type, selection, labels, extra.data(), NeighborMatch::NoNeighbor);
+    }
+}
+
+int main()
+{
+    Checker checker;
+    mt19937_64 random(170);
+    uniform_int_distribution<int> gridPoint(0, 4);
+
+    for (size_t numInstances : {1, 2, 3, 5, 7, 9, 13, 15, 17, 31, 33, 63, 65, 101, 259})
+    {
+        for (size_t numColumns : {1, 2, 3, 5})
+        {
+            // Values on a grid of quarters make equal distances common, and
+            // each row in the second half repeats an earlier row
+            vector<double> values(numInstances * numColumns);
+            vector<int> labels(numInstances);
+            for (size_t i = 0; i < numInstances; i++)
+            {
+                size_t copied = i >= numInstances / 2 && i > 0 ? random() % i : i;
+                for (size_t j = 0; j < numColumns; j++)
+                {
+                    values[i * numColumns + j] =
+                        copied == i ? gridPoint(random) / 4.0 : values[copied * numColumns + j];
+                }
+                labels[i] = 1 + static_cast<int>(random() % 2);
+            }
+            Dataset data = Dataset::FromRowMajor(values, numInstances, numColumns);
+
+            // All columns in order, then in reverse through an index list
+            vector<size_t> allFeatures, reversedFeatures;
+            for (size_t j = 0; j < numColumns; j++)
+            {
+                allFeatures.push_back(j);
+                reversedFeatures.insert(reversedFeatures.begin(), j);
+            }
+
+            vector<vector<double>> extraQueries(3, vector<double>(numColumns));
+            for (vector<double> &extra : extraQueries)
+            {
+                for (double &value : extra)
+                {
+                    value = (gridPoint(random) + 0.5) / 4.0;
+                }
+            }
+            vector<vector<double>> extraCodes = extraQueries;
+            for (vector<double> &extra : extraCodes)
+            {
+                for (double &value : extra)
+                {
+                    value = static_cast<double>(lround(min(value, 1.0) * Int16Scale));
+                }
+            }
+
+            BasicDataset<float> float32Data = ToFloat32(data);
+            BasicDataset<int16_t> int16Data = ToInt16(data);
+            for (const vector<size_t> *features : {&allFeatures, &reversedFeatures})
+            {
+                CheckDataset(checker, "double", data, labels, *features, extraQueries);
+                CheckDataset(checker, "float32", float32Data, labels, *features, extraQueries);
+                CheckDataset(checker, "int16", int16Data, labels, *features, extraCodes);
+            }
+        }
+    }
+
+    cout << checker.checks - checker.failures << " of " << checker.checks << " nearest-neighbor checks passed ("
+         << DistanceKernelName(DetectDistanceKernel()) << " is the widest kernel here)\n";
+    return checker.failures == 0 ? 0 : 1;
+}
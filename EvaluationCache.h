@@ -0,0 +1,233 @@
+#ifndef EVALUATION_CACHE_H
+#define EVALUATION_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FeatureSubset.h"
+
+// Accuracies of feature subsets already scored, so a search that meets a
+// subset again (in another search direction, another job on the same data
+// or a later run) does not scan the dataset for it. Results are kept in a
+// hash table and, when a path is given, appended to a log file that the
+// next cache opened on that path starts from. Each record is flushed as it
+// is made, so a run that is interrupted keeps everything it finished.
+class EvaluationCache
+{
+public:
+    // Everything a subset's accuracy depends on
+    struct Key
+    {
+        std::uint64_t dataset;  // Checksum of the labels and normalized columns
+        std::uint64_t settings; // Evaluation settings that change results
+        FeatureSubset features;
+
+        bool operator==(const Key &other) const
+        {
+            return dataset == other.dataset && settings == other.settings && features == other.features;
+        }
+    };
+
+    // A full evaluation, or for one stopped early an upper bound on its accuracy
+    struct Entry
+    {
+        double accuracy = 0.0;
+        bool exact = false;
+    };
+
+    struct Stats
+    {
+        std::size_t hits = 0;
+        std::size_t misses = 0;
+        std::size_t entries = 0;
+        std::size_t loaded = 0; // Entries read back from the file
+    };
+
+private:
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &key) const
+        {
+            std::uint64_t hash = (key.dataset ^ (key.settings * 0x9e3779b97f4a7c15ull)) * 1099511628211ull;
+            return static_cast<std::size_t>(hash ^ key.features.hash());
+        }
+    };
+
+    static constexpr char Magic[8] = {'N', 'N', 'E', 'V', 'A', 'L', '\r', '\n'};
+    static constexpr std::uint32_t Version = 1;
+
+    // On disk each record is this, followed by the low numWords words of
+    // the subset's bitset
+    struct RecordHeader
+    {
+        std::uint64_t dataset;
+        std::uint64_t settings;
+        double accuracy;
+        std::uint32_t exact;
+        std::uint32_t numWords;
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    mutable std::mutex mutex;
+    std::ofstream log;
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+    std::size_t loaded = 0;
+
+    // Keeps the better of two things known about one subset
+    static void merge(Entry &known, const Entry &entry)
+    {
+        if (!known.exact && (entry.exact || entry.accuracy < known.accuracy))
+        {
+            known = entry;
+        }
+    }
+
+    // Reads the records of the file at path and returns how many of its
+    // bytes they cover; 0 when it is missing or not a cache of this version
+    std::size_t load(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::size_t prefix = sizeof(Magic) + sizeof(Version);
+        std::uint32_t version = 0;
+        if (bytes.size() < prefix || std::memcmp(bytes.data(), Magic, sizeof(Magic)) != 0)
+        {
+            return 0;
+        }
+        std::memcpy(&version, bytes.data() + sizeof(Magic), sizeof(version));
+        if (version != Version)
+        {
+            return 0;
+        }
+
+        // A record cut short by an interrupted run ends the valid part
+        std::size_t offset = prefix;
+        while (bytes.size() - offset >= sizeof(RecordHeader))
+        {
+            RecordHeader record;
+            std::memcpy(&record, bytes.data() + offset, sizeof(record));
+            std::size_t maskBytes = std::size_t(record.numWords) * sizeof(std::uint64_t);
+            if (bytes.size() - offset - sizeof(record) < maskBytes)
+            {
+                break;
+            }
+            // Subsets wider than FeatureSubset holds cannot be asked for
+            if (record.numWords <= FeatureSubset::NumWords)
+            {
+                std::vector<std::uint64_t> words(record.numWords);
+                std::memcpy(words.data(), bytes.data() + offset + sizeof(record), maskBytes);
+                Key key = {record.dataset, record.settings, FeatureSubset::FromWords(words.data(), words.size())};
+                Entry entry = {record.accuracy, record.exact != 0};
+                auto inserted = entries.emplace(key, entry);
+                if (!inserted.second)
+                {
+                    merge(inserted.first->second, entry);
+                }
+                loaded++;
+            }
+            offset += sizeof(record) + maskBytes;
+        }
+        return offset;
+    }
+
+    void append(const Key &key, const Entry &entry)
+    {
+        std::size_t numWords = key.features.wordsUsed();
+        RecordHeader record = {key.dataset, key.settings, entry.accuracy, entry.exact ? 1u : 0u,
+                               static_cast<std::uint32_t>(numWords)};
+        log.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        log.write(reinterpret_cast<const char *>(key.features.data()),
+                  static_cast<std::streamsize>(numWords * sizeof(std::uint64_t)));
+        log.flush();
+    }
+
+public:
+    // An empty path keeps results in memory only
+    explicit EvaluationCache(const std::string &path = "")
+    {
+        if (path.empty())
+        {
+            return;
+        }
+
+        std::size_t validBytes = load(path);
+        if (validBytes == 0)
+        {
+            log.open(path, std::ios::binary | std::ios::trunc);
+            log.write(Magic, sizeof(Magic));
+            log.write(reinterpret_cast<const char *>(&Version), sizeof(Version));
+        }
+        else
+        {
+            // Drops a torn record at the end before appending after it
+            std::ifstream file(path, std::ios::binary);
+            std::vector<char> valid(validBytes);
+            file.read(valid.data(), static_cast<std::streamsize>(validBytes));
+            file.close();
+            log.open(path, std::ios::binary | std::ios::trunc);
+            log.write(valid.data(), static_cast<std::streamsize>(validBytes));
+        }
+        if (!log.flush())
+        {
+            throw std::runtime_error("Cannot write evaluation cache: " + path);
+        }
+    }
+
+    EvaluationCache(const EvaluationCache &) = delete;
+    EvaluationCache &operator=(const EvaluationCache &) = delete;
+
+    // Finds what is known about key. Succeeds when that answers an
+    // evaluation with the given target: a full result always does, an
+    // upper bound only when it is already below the target.
+    bool lookup(const Key &key, double targetAccuracy, Entry &entry)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(key);
+            if (found != entries.end() && (found->second.exact || found->second.accuracy < targetAccuracy))
+            {
+                entry = found->second;
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void record(const Key &key, const Entry &entry)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto inserted = entries.emplace(key, entry);
+        if (!inserted.second)
+        {
+            Entry before = inserted.first->second;
+            merge(inserted.first->second, entry);
+            if (inserted.first->second.exact == before.exact && inserted.first->second.accuracy == before.accuracy)
+            {
+                return;
+            }
+        }
+        if (log.is_open())
+        {
+            append(key, entry);
+        }
+    }
+
+    Stats getStats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {hits.load(), misses.load(), entries.size(), loaded};
+    }
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef FEATURE_SUBSET_H
+#define FEATURE_SUBSET_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+// A set of feature indices held as a fixed-size bitset, so adding,
+// removing and testing a feature take constant time and copying one never
+// allocates. Iterating visits the features in ascending order, the order
+// the distance kernels sum them in.
+class FeatureSubset
+{
+public:
+    // Features 0 to Capacity - 1 can be members
+    static constexpr std::size_t Capacity = 1024;
+    static constexpr std::size_t NumWords = Capacity / 64;
+
+    // Walks the set bits from the lowest up
+    class Iterator
+    {
+    private:
+        const std::uint64_t *words;
+        std::size_t word;
+        std::uint64_t remaining; // Bits of words[word] not visited yet
+
+        void skipEmptyWords()
+        {
+            while (remaining == 0 && word < NumWords)
+            {
+                word++;
+                remaining = word < NumWords ? words[word] : 0;
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::size_t *;
+        using reference = std::size_t;
+
+        Iterator(const std::uint64_t *words, std::size_t word)
+            : words(words), word(word), remaining(word < NumWords ? words[word] : 0)
+        {
+            skipEmptyWords();
+        }
+
+        std::size_t operator*() const
+        {
+            return word * 64 + static_cast<std::size_t>(__builtin_ctzll(remaining));
+        }
+
+        Iterator &operator++()
+        {
+            remaining &= remaining - 1;
+            skipEmptyWords();
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const
+        {
+            return word == other.word && remaining == other.remaining;
+        }
+
+        bool operator!=(const Iterator &other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+private:
+    std::array<std::uint64_t, NumWords> words{};
+    std::size_t count = 0;
+
+    static void checkFeature(std::size_t feature)
+    {
+        if (feature >= Capacity)
+        {
+            throw std::out_of_range("Feature index beyond FeatureSubset capacity");
+        }
+    }
+
+public:
+    FeatureSubset() = default;
+
+    FeatureSubset(std::initializer_list<std::size_t> features)
+    {
+        for (std::size_t feature : features)
+        {
+            add(feature);
+        }
+    }
+
+    // Features 0 to numFeatures - 1
+    static FeatureSubset All(std::size_t numFeatures)
+    {
+        FeatureSubset subset;
+        for (std::size_t feature = 0; feature < numFeatures; feature++)
+        {
+            subset.add(feature);
+        }
+        return subset;
+    }
+
+    static FeatureSubset FromIndices(const std::vector<std::size_t> &features)
+    {
+        FeatureSubset subset;
+        for (std::size_t feature : features)
+        {
+            subset.add(feature);
+        }
+        return subset;
+    }
+
+    // Rebuilds a subset from the low words of its bitset, as kept by
+    // wordsUsed(); the rest are zero
+    static FeatureSubset FromWords(const std::uint64_t *source, std::size_t numWords)
+    {
+        if (numWords > NumWords)
+        {
+            throw std::out_of_range("Feature index beyond FeatureSubset capacity");
+        }
+        FeatureSubset subset;
+        for (std::size_t i = 0; i < numWords; i++)
+        {
+            subset.words[i] = source[i];
+            subset.count += static_cast<std::size_t>(__builtin_popcountll(source[i]));
+        }
+        return subset;
+    }
+
+    bool contains(std::size_t feature) const
+    {
+        return feature < Capacity && (words[feature / 64] >> (feature % 64) & 1) != 0;
+    }
+
+    void add(std::size_t feature)
+    {
+        checkFeature(feature);
+        std::uint64_t bit = std::uint64_t(1) << (feature % 64);
+        count += (words[feature / 64] & bit) == 0;
+        words[feature / 64] |= bit;
+    }
+
+    void remove(std::size_t feature)
+    {
+        checkFeature(feature);
+        std::uint64_t bit = std::uint64_t(1) << (feature % 64);
+        count -= (words[feature / 64] & bit) != 0;
+        words[feature / 64] &= ~bit;
+    }
+
+    // Copies of this subset with one feature added or taken away
+    FeatureSubset with(std::size_t feature) const
+    {
+        FeatureSubset subset = *this;
+        subset.add(feature);
+        return subset;
+    }
+
+    FeatureSubset without(std::size_t feature) const
+    {
+        FeatureSubset subset = *this;
+        subset.remove(feature);
+        return subset;
+    }
+
+    std::size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    Iterator begin() const
+    {
+        return Iterator(words.data(), 0);
+    }
+
+    Iterator end() const
+    {
+        return Iterator(words.data(), NumWords);
+    }
+
+    // The members in ascending order
+    std::vector<std::size_t> indices() const
+    {
+        std::vector<std::size_t> features;
+        features.reserve(count);
+        for (std::size_t feature : *this)
+        {
+            features.push_back(feature);
+        }
+        return features;
+    }
+
+    const std::uint64_t *data() const
+    {
+        return words.data();
+    }
+
+    // Words up to and including the last nonzero one
+    std::size_t wordsUsed() const
+    {
+        std::size_t used = NumWords;
+        while (used > 0 && words[used - 1] == 0)
+        {
+            used--;
+        }
+        return used;
+    }
+
+    std::size_t hash() const
+    {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (std::uint64_t word : words)
+        {
+            hash = (hash ^ word) * 1099511628211ull;
+            hash ^= hash >> 29;
+        }
+        return static_cast<std::size_t>(hash);
+    }
+
+    bool operator==(const FeatureSubset &other) const
+    {
+        return words == other.words;
+    }
+
+    bool operator!=(const FeatureSubset &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "DistanceKernels.h"
+#include "Metrics.h"
+
+// A k-d tree over the selected columns of a Dataset, for nearest-neighbor
+// queries on low-dimensional subsets where pruning whole regions beats
+// scanning every row. Distances are summed in the same order as the brute
+// force kernels and ties go to the lowest row index, so a query returns
+// exactly what FindNearest would. Past a handful of dimensions almost no
+// region can be pruned and a linear scan is faster; callers should only
+// build a tree for small subsets.
+class KdTree
+{
+private:
+    struct Node
+    {
+        std::size_t begin = 0; // Points [begin, end) in tree order
+        std::size_t end = 0;
+        std::size_t splitDimension = 0;
+        double splitValue = 0.0;
+        std::int64_t left = -1; // Children, or -1 for a leaf
+        std::int64_t right = -1;
+    };
+
+    static constexpr std::size_t LeafSize = 8;
+
+    std::size_t numDimensions = 0;
+    std::vector<double> points;       // Row-major, numDimensions values per point, in tree order
+    std::vector<std::size_t> indices; // Dataset row of each point, in tree order
+    std::vector<Node> nodes;
+
+    std::int64_t build(const ColumnSelection &selection, std::size_t begin, std::size_t end)
+    {
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        std::int64_t nodeIndex = static_cast<std::int64_t>(nodes.size());
+        nodes.push_back(node);
+        if (end - begin <= LeafSize)
+        {
+            return nodeIndex;
+        }
+
+        // Split the widest dimension at its median
+        double widestSpread = -1.0;
+        for (std::size_t j = 0; j < numDimensions; j++)
+        {
+            const double *column = selection.column(j);
+            auto bounds = std::minmax_element(indices.begin() + begin, indices.begin() + end,
+                                              [&](std::size_t a, std::size_t b)
+                                              { return column[a] < column[b]; });
+            double spread = column[*bounds.second] - column[*bounds.first];
+            if (spread > widestSpread)
+            {
+                widestSpread = spread;
+                node.splitDimension = j;
+            }
+        }
+
+        const double *splitColumn = selection.column(node.splitDimension);
+        std::size_t middle = begin + (end - begin) / 2;
+        std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end,
+                         [&](std::size_t a, std::size_t b)
+                         { return splitColumn[a] < splitColumn[b]; });
+        node.splitValue = splitColumn[indices[middle]];
+
+        node.left = build(selection, begin, middle);
+        node.right = build(selection, middle, end);
+        nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    void search(std::int64_t nodeIndex, const double *query, std::size_t excluded, NeighborMatch &best) const
+    {
+        const Node &node = nodes[nodeIndex];
+        if (node.left < 0)
+        {
+            for (std::size_t p = node.begin; p < node.end; p++)
+            {
+                std::size_t index = indices[p];
+                if (index == excluded)
+                {
+                    continue;
+                }
+
+                const double *point = points.data() + p * numDimensions;
+                double distance = 0.0;
+                for (std::size_t j = 0; j < numDimensions; j++)
+                {
+                    double difference = query[j] - point[j];
+                    distance += difference * difference;
+                }
+
+                if (distance < best.distance ||
+                    (distance == best.distance && best.index != NeighborMatch::NoNeighbor && index < best.index))
+                {
+                    best.distance = distance;
+                    best.index = index;
+                }
+            }
+            return;
+        }
+
+        // Left points are <= splitValue and right points >= splitValue, so
+        // the far side is at least this far away along the split dimension.
+        // A far side exactly as far as the best can still hold a tie with a
+        // lower row index, so it is only skipped when strictly farther.
+        double offset = query[node.splitDimension] - node.splitValue;
+        std::int64_t nearSide = offset < 0.0 ? node.left : node.right;
+        std::int64_t farSide = offset < 0.0 ? node.right : node.left;
+        search(nearSide, query, excluded, best);
+        if (offset * offset <= best.distance)
+        {
+            search(farSide, query, excluded, best);
+        }
+    }
+
+public:
+    explicit KdTree(const ColumnSelection &selection)
+        : numDimensions(selection.numFeatures)
+    {
+        NN_METRIC_TIMER("kd_tree_build");
+        std::size_t numInstances = selection.data->getNumInstances();
+        indices.resize(numInstances);
+        for (std::size_t i = 0; i < numInstances; i++)
+        {
+            indices[i] = i;
+        }
+        if (numInstances > 0)
+        {
+            build(selection, 0, numInstances);
+        }
+
+        // Copy the points in tree order so a leaf is one contiguous block
+        points.resize(numInstances * numDimensions);
+        for (std::size_t j = 0; j < numDimensions; j++)
+        {
+            const double *column = selection.column(j);
+            for (std::size_t p = 0; p < numInstances; p++)
+            {
+                points[p * numDimensions + j] = column[indices[p]];
+            }
+        }
+    }
+
+    // Nearest point to query (one value per selected column), skipping the
+    // row at index excluded
+    NeighborMatch findNearest(const double *query, std::size_t excluded = NeighborMatch::NoNeighbor) const
+    {
+        NeighborMatch best;
+        if (!nodes.empty())
+        {
+            search(0, query, excluded, best);
+        }
+        return best;
+    }
+};
+
+#endif
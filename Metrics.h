@@ -0,0 +1,357 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Timers and counters for the hot paths, cheap enough to leave on in
+// production runs. Each instrumented site looks its metric up by name once
+// (a function-local static); after that a count is one relaxed atomic add
+// on a shard owned by the calling thread, so workers do not contend on a
+// cache line. Building with -DNN_NO_METRICS turns every NN_METRIC_* macro
+// into nothing, leaving the reports empty.
+namespace Metrics
+{
+    constexpr std::size_t NumShards = 16;
+
+    // Threads are dealt shards round-robin as they first count something
+    inline std::size_t ShardIndex()
+    {
+        static std::atomic<std::size_t> nextShard{0};
+        thread_local std::size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % NumShards;
+        return shard;
+    }
+
+    class Counter
+    {
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<std::uint64_t> value{0};
+        };
+        Shard shards[NumShards];
+
+    public:
+        void add(std::uint64_t amount)
+        {
+            shards[ShardIndex()].value.fetch_add(amount, std::memory_order_relaxed);
+        }
+
+        std::uint64_t value() const
+        {
+            std::uint64_t total = 0;
+            for (const Shard &shard : shards)
+            {
+                total += shard.value.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+    };
+
+    // Number of timed calls, their total and their longest duration
+    class Timer
+    {
+    private:
+        Counter calls;
+        Counter nanoseconds;
+        std::atomic<std::uint64_t> longest{0};
+
+    public:
+        void record(std::uint64_t elapsed)
+        {
+            calls.add(1);
+            nanoseconds.add(elapsed);
+            std::uint64_t previous = longest.load(std::memory_order_relaxed);
+            while (elapsed > previous && !longest.compare_exchange_weak(previous, elapsed, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        std::uint64_t getCalls() const
+        {
+            return calls.value();
+        }
+
+        std::uint64_t getNanoseconds() const
+        {
+            return nanoseconds.value();
+        }
+
+        std::uint64_t getLongest() const
+        {
+            return longest.load(std::memory_order_relaxed);
+        }
+    };
+
+    // Adds the lifetime of the scope it is declared in to a timer
+    class ScopedTimer
+    {
+    private:
+        Timer &timer;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit ScopedTimer(Timer &timer)
+            : timer(timer), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        ~ScopedTimer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            timer.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+    };
+
+    // Milliseconds since construction, for one search level
+    class Stopwatch
+    {
+    private:
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    public:
+        double milliseconds() const
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    // One level of a forward or backward search
+    struct LevelStats
+    {
+        std::string search;
+        std::size_t level;
+        std::size_t candidates;
+        std::size_t pruned;
+        double bestAccuracy;
+        double milliseconds;
+    };
+
+    // Every metric of the process, by name. Metrics are never removed, so
+    // the references handed out stay valid.
+    class Registry
+    {
+    private:
+        mutable std::mutex mutex;
+        std::map<std::string, std::unique_ptr<Timer>> timers;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::vector<LevelStats> levels;
+
+    public:
+        static Registry &instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        Timer &timer(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<Timer> &slot = timers[name];
+            if (!slot)
+            {
+                slot = std::make_unique<Timer>();
+            }
+            return *slot;
+        }
+
+        Counter &counter(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<Counter> &slot = counters[name];
+            if (!slot)
+            {
+                slot = std::make_unique<Counter>();
+            }
+            return *slot;
+        }
+
+        void recordLevel(const LevelStats &stats)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            levels.push_back(stats);
+        }
+
+        // Calls visitTimer(name, timer) and visitCounter(name, counter) in
+        // name order, then visitLevel(stats) in the order levels finished
+        template <typename VisitTimer, typename VisitCounter, typename VisitLevel>
+        void visit(const VisitTimer &visitTimer, const VisitCounter &visitCounter, const VisitLevel &visitLevel) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &entry : timers)
+            {
+                visitTimer(entry.first, *entry.second);
+            }
+            for (const auto &entry : counters)
+            {
+                visitCounter(entry.first, *entry.second);
+            }
+            for (const LevelStats &stats : levels)
+            {
+                visitLevel(stats);
+            }
+        }
+    };
+
+    // Human-readable tables of every timer, counter and search level
+    inline void WriteSummary(std::ostream &out)
+    {
+        std::ios_base::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        bool timerHeader = false, counterHeader = false, levelHeader = false;
+        out << std::fixed;
+        Registry::instance().visit(
+            [&](const std::string &name, const Timer &timer)
+            {
+                if (!timerHeader)
+                {
+                    out << "\n" << std::left << std::setw(24) << "Timer" << std::right << std::setw(10) << "Calls"
+                        << std::setw(14) << "Total ms" << std::setw(12) << "Mean us" << std::setw(12) << "Max us" << "\n";
+                    timerHeader = true;
+                }
+                std::uint64_t calls = timer.getCalls();
+                double total = timer.getNanoseconds() / 1e6;
+                double mean = calls == 0 ? 0.0 : timer.getNanoseconds() / 1e3 / calls;
+                out << std::left << std::setw(24) << name << std::right << std::setw(10) << calls
+                    << std::setprecision(3) << std::setw(14) << total << std::setprecision(1) << std::setw(12) << mean
+                    << std::setw(12) << timer.getLongest() / 1e3 << "\n";
+            },
+            [&](const std::string &name, const Counter &counter)
+            {
+                if (!counterHeader)
+                {
+                    out << "\n" << std::left << std::setw(24) << "Counter" << std::right << std::setw(20) << "Value" << "\n";
+                    counterHeader = true;
+                }
+                out << std::left << std::setw(24) << name << std::right << std::setw(20) << counter.value() << "\n";
+            },
+            [&](const LevelStats &stats)
+            {
+                if (!levelHeader)
+                {
+                    out << "\n" << std::left << std::setw(10) << "Search" << std::right << std::setw(7) << "Level"
+                        << std::setw(12) << "Candidates" << std::setw(8) << "Pruned" << std::setw(10) << "Best"
+                        << std::setw(12) << "ms" << "\n";
+                    levelHeader = true;
+                }
+                out << std::left << std::setw(10) << stats.search << std::right << std::setw(7) << stats.level
+                    << std::setw(12) << stats.candidates << std::setw(8) << stats.pruned << std::setprecision(3)
+                    << std::setw(10) << stats.bestAccuracy << std::setw(12) << stats.milliseconds << "\n";
+            });
+        if (!timerHeader && !counterHeader && !levelHeader)
+        {
+            out << "\nNo metrics were recorded\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    inline void WriteJson(std::ostream &out)
+    {
+        std::vector<std::string> timers, counters, levels;
+        Registry::instance().visit(
+            [&](const std::string &name, const Timer &timer)
+            {
+                timers.push_back("{\"name\": \"" + name + "\", \"calls\": " + std::to_string(timer.getCalls()) +
+                                 ", \"total_ns\": " + std::to_string(timer.getNanoseconds()) +
+                                 ", \"max_ns\": " + std::to_string(timer.getLongest()) + "}");
+            },
+            [&](const std::string &name, const Counter &counter)
+            {
+                counters.push_back("{\"name\": \"" + name + "\", \"value\": " + std::to_string(counter.value()) + "}");
+            },
+            [&](const LevelStats &stats)
+            {
+                levels.push_back("{\"search\": \"" + stats.search + "\", \"level\": " + std::to_string(stats.level) +
+                                 ", \"candidates\": " + std::to_string(stats.candidates) +
+                                 ", \"pruned\": " + std::to_string(stats.pruned) +
+                                 ", \"best_accuracy\": " + std::to_string(stats.bestAccuracy) +
+                                 ", \"ms\": " + std::to_string(stats.milliseconds) + "}");
+            });
+
+        auto writeArray = [&](const char *key, const std::vector<std::string> &items, bool last)
+        {
+            out << "  \"" << key << "\": [";
+            for (std::size_t i = 0; i < items.size(); i++)
+            {
+                out << (i == 0 ? "\n    " : ",\n    ") << items[i];
+            }
+            out << (items.empty() ? "]" : "\n  ]") << (last ? "\n" : ",\n");
+        };
+        out << "{\n";
+        writeArray("timers", timers, false);
+        writeArray("counters", counters, false);
+        writeArray("levels", levels, true);
+        out << "}\n";
+    }
+
+    // Prometheus text exposition format
+    inline void WritePrometheus(std::ostream &out)
+    {
+        std::ostringstream calls, seconds, longest, counters, levels;
+        Registry::instance().visit(
+            [&](const std::string &name, const Timer &timer)
+            {
+                calls << "nn_timer_calls_total{name=\"" << name << "\"} " << timer.getCalls() << "\n";
+                seconds << "nn_timer_seconds_total{name=\"" << name << "\"} " << timer.getNanoseconds() / 1e9 << "\n";
+                longest << "nn_timer_max_seconds{name=\"" << name << "\"} " << timer.getLongest() / 1e9 << "\n";
+            },
+            [&](const std::string &name, const Counter &counter)
+            {
+                counters << "nn_counter_total{name=\"" << name << "\"} " << counter.value() << "\n";
+            },
+            [&](const LevelStats &stats)
+            {
+                std::string labels = "{search=\"" + stats.search + "\",level=\"" + std::to_string(stats.level) + "\"}";
+                levels << "nn_search_level_candidates" << labels << " " << stats.candidates << "\n"
+                       << "nn_search_level_pruned" << labels << " " << stats.pruned << "\n"
+                       << "nn_search_level_best_accuracy" << labels << " " << stats.bestAccuracy << "\n"
+                       << "nn_search_level_seconds" << labels << " " << stats.milliseconds / 1e3 << "\n";
+            });
+        out << "# TYPE nn_timer_calls_total counter\n" << calls.str()
+            << "# TYPE nn_timer_seconds_total counter\n" << seconds.str()
+            << "# TYPE nn_timer_max_seconds gauge\n" << longest.str()
+            << "# TYPE nn_counter_total counter\n" << counters.str()
+            << "# TYPE nn_search_level_candidates gauge\n# TYPE nn_search_level_pruned gauge\n"
+            << "# TYPE nn_search_level_best_accuracy gauge\n# TYPE nn_search_level_seconds gauge\n" << levels.str();
+    }
+}
+
+#define NN_METRICS_CONCAT_(a, b) a##b
+#define NN_METRICS_CONCAT(a, b) NN_METRICS_CONCAT_(a, b)
+
+#ifndef NN_NO_METRICS
+// Times the rest of the enclosing scope under name
+#define NN_METRIC_TIMER(name)                                                                                  \
+    static Metrics::Timer &NN_METRICS_CONCAT(metricTimer_, __LINE__) = Metrics::Registry::instance().timer(name); \
+    Metrics::ScopedTimer NN_METRICS_CONCAT(metricScope_, __LINE__)(NN_METRICS_CONCAT(metricTimer_, __LINE__))
+// Adds amount to the counter called name
+#define NN_METRIC_COUNT(name, amount)                                                         \
+    do                                                                                        \
+    {                                                                                         \
+        static Metrics::Counter &metricCounter = Metrics::Registry::instance().counter(name); \
+        metricCounter.add(amount);                                                            \
+    } while (0)
+// Records one finished search level (a Metrics::LevelStats initializer)
+#define NN_METRIC_LEVEL(...) Metrics::Registry::instance().recordLevel(Metrics::LevelStats{__VA_ARGS__})
+#else
+#define NN_METRIC_TIMER(name) static_cast<void>(0)
+#define NN_METRIC_COUNT(name, amount) static_cast<void>(0)
+#define NN_METRIC_LEVEL(...) static_cast<void>(0)
+#endif
+
+#endif
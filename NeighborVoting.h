@@ -0,0 +1,82 @@
+#ifndef NEIGHBOR_VOTING_H
+#define NEIGHBOR_VOTING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// Votes of a query's nearest neighbors over class ids 0..numClasses-1,
+// added nearest first, so after the k-th neighbor winner() is the k-NN
+// prediction and one sorted neighbor list yields every k at once. Under
+// majority voting each neighbor counts once; under distance weighting it
+// counts 1 / distance, and neighbors at distance zero, if there are any,
+// outvote all others. Ties go to the class whose first vote came from the
+// nearest neighbor, so k = 1 always predicts the nearest neighbor's class.
+class NeighborVotes
+{
+private:
+    bool weighted;
+    std::vector<double> votes;
+    std::vector<std::size_t> exactVotes; // Neighbors at distance zero, when weighted
+    std::vector<std::size_t> firstVote;  // Position of each class's first neighbor
+    std::size_t added = 0;
+    bool anyExact = false;
+
+public:
+    NeighborVotes(std::size_t numClasses, bool weighted)
+        : weighted(weighted), votes(numClasses), exactVotes(numClasses), firstVote(numClasses)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        std::fill(votes.begin(), votes.end(), 0.0);
+        std::fill(exactVotes.begin(), exactVotes.end(), 0);
+        std::fill(firstVote.begin(), firstVote.end(), std::numeric_limits<std::size_t>::max());
+        added = 0;
+        anyExact = false;
+    }
+
+    // squaredDistance is the neighbor's squared Euclidean distance
+    void add(std::size_t classId, double squaredDistance)
+    {
+        if (firstVote[classId] == std::numeric_limits<std::size_t>::max())
+        {
+            firstVote[classId] = added;
+        }
+        added++;
+        if (!weighted)
+        {
+            votes[classId] += 1.0;
+        }
+        else if (squaredDistance == 0.0)
+        {
+            exactVotes[classId]++;
+            anyExact = true;
+        }
+        else
+        {
+            votes[classId] += 1.0 / std::sqrt(squaredDistance);
+        }
+    }
+
+    std::size_t winner() const
+    {
+        std::size_t best = 0;
+        for (std::size_t c = 1; c < votes.size(); c++)
+        {
+            double score = anyExact ? static_cast<double>(exactVotes[c]) : votes[c];
+            double bestScore = anyExact ? static_cast<double>(exactVotes[best]) : votes[best];
+            if (score > bestScore || (score == bestScore && firstVote[c] < firstVote[best]))
+            {
+                best = c;
+            }
+        }
+        return best;
+    }
+};
+
+#endif
@@ -0,0 +1,298 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PERF_COUNTERS_LINUX 1
+#endif
+
+// Hardware counters (cycles, instructions, last-level cache misses and
+// branch misses) read with perf_event_open around phases of a normal run.
+// Each thread opens its own counter group the first time it enters a
+// phase, since counters only follow the thread that opened them, and adds
+// what it counted to the phase's totals. A phase also records how many
+// distances it computed, so misses can be put per distance. Off until
+// Profiler::enable(); when off, a phase costs one branch. Only available on
+// Linux, and only where the kernel lets unprivileged processes count their
+// own events (perf_event_paranoid of 2 or less).
+namespace PerfCounters
+{
+    enum Event
+    {
+        Cycles,
+        Instructions,
+        LlcMisses,
+        BranchMisses,
+        NumEvents
+    };
+
+    struct Sample
+    {
+        std::uint64_t values[NumEvents] = {};
+        std::uint64_t timeEnabled = 0;
+        std::uint64_t timeRunning = 0;
+    };
+
+    // The calling thread's counter group; the cycles counter leads it, so
+    // all four are scheduled, and read, together
+    class ThreadCounters
+    {
+    private:
+        int descriptors[NumEvents] = {-1, -1, -1, -1};
+        int error = 0;
+
+    public:
+        ThreadCounters()
+        {
+#ifdef PERF_COUNTERS_LINUX
+            const std::uint64_t configs[NumEvents] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            for (int event = 0; event < NumEvents; event++)
+            {
+                perf_event_attr attributes;
+                std::memset(&attributes, 0, sizeof(attributes));
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.size = sizeof(attributes);
+                attributes.config = configs[event];
+                attributes.exclude_kernel = 1;
+                attributes.exclude_hv = 1;
+                attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+                int leader = event == 0 ? -1 : descriptors[0];
+                descriptors[event] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, leader, 0));
+                if (descriptors[event] < 0)
+                {
+                    error = errno;
+                    close();
+                    return;
+                }
+            }
+#else
+            error = ENOSYS;
+#endif
+        }
+
+        ~ThreadCounters()
+        {
+            close();
+        }
+
+        ThreadCounters(const ThreadCounters &) = delete;
+        ThreadCounters &operator=(const ThreadCounters &) = delete;
+
+        void close()
+        {
+#ifdef PERF_COUNTERS_LINUX
+            for (int &descriptor : descriptors)
+            {
+                if (descriptor >= 0)
+                {
+                    ::close(descriptor);
+                }
+                descriptor = -1;
+            }
+#endif
+        }
+
+        bool isOpen() const
+        {
+            return descriptors[0] >= 0;
+        }
+
+        // errno of the perf_event_open call that failed, or 0
+        int getError() const
+        {
+            return error;
+        }
+
+        bool read(Sample &sample) const
+        {
+#ifdef PERF_COUNTERS_LINUX
+            // nr, time enabled, time running, then one value per event
+            std::uint64_t buffer[3 + NumEvents];
+            if (!isOpen() || ::read(descriptors[0], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)))
+            {
+                return false;
+            }
+            sample.timeEnabled = buffer[1];
+            sample.timeRunning = buffer[2];
+            for (int event = 0; event < NumEvents; event++)
+            {
+                sample.values[event] = buffer[3 + event];
+            }
+            return true;
+#else
+            (void)sample;
+            return false;
+#endif
+        }
+
+        // This thread's group, opened on first use
+        static const ThreadCounters &current()
+        {
+            thread_local ThreadCounters counters;
+            return counters;
+        }
+    };
+
+    // What every thread counted inside one phase
+    struct Phase
+    {
+        std::atomic<std::uint64_t> values[NumEvents] = {};
+        std::atomic<std::uint64_t> calls{0};
+        std::atomic<std::uint64_t> distances{0};
+    };
+
+    class Profiler
+    {
+    private:
+        std::atomic<bool> enabled{false};
+        mutable std::mutex mutex;
+        std::map<std::string, std::unique_ptr<Phase>> phases;
+
+    public:
+        static Profiler &instance()
+        {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        // Turns counting on if this thread can open the counters; otherwise
+        // leaves it off and returns why
+        bool enable(std::string &reason)
+        {
+            const ThreadCounters &counters = ThreadCounters::current();
+            if (!counters.isOpen())
+            {
+                reason = std::strerror(counters.getError());
+                return false;
+            }
+            enabled.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        bool isEnabled() const
+        {
+            return enabled.load(std::memory_order_relaxed);
+        }
+
+        Phase &phase(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::unique_ptr<Phase> &slot = phases[name];
+            if (!slot)
+            {
+                slot = std::make_unique<Phase>();
+            }
+            return *slot;
+        }
+
+        // One row per phase: raw counts, instructions per cycle, and cycles
+        // and misses per distance computed
+        void report(std::ostream &out) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::ios_base::fmtflags flags = out.flags();
+            std::streamsize precision = out.precision();
+            out << "\n" << std::left << std::setw(22) << "Phase" << std::right << std::setw(10) << "Calls"
+                << std::setw(16) << "Cycles" << std::setw(16) << "Instructions" << std::setw(7) << "IPC"
+                << std::setw(14) << "LLC misses" << std::setw(14) << "Branch misses" << std::setw(16) << "Distances"
+                << std::setw(12) << "Cycles/dist" << std::setw(12) << "LLC/dist" << std::setw(12) << "Branch/dist" << "\n";
+            for (const auto &entry : phases)
+            {
+                const Phase &phase = *entry.second;
+                if (phase.calls.load() == 0)
+                {
+                    continue;
+                }
+                double cycles = static_cast<double>(phase.values[Cycles].load());
+                double instructions = static_cast<double>(phase.values[Instructions].load());
+                double llcMisses = static_cast<double>(phase.values[LlcMisses].load());
+                double branchMisses = static_cast<double>(phase.values[BranchMisses].load());
+                double distances = static_cast<double>(phase.distances.load());
+                out << std::left << std::setw(22) << entry.first << std::right << std::setw(10) << phase.calls.load()
+                    << std::fixed << std::setprecision(0) << std::setw(16) << cycles << std::setw(16) << instructions
+                    << std::setprecision(2) << std::setw(7) << (cycles == 0 ? 0.0 : instructions / cycles)
+                    << std::setprecision(0) << std::setw(14) << llcMisses << std::setw(14) << branchMisses;
+                // Phases that do not count their distances leave these columns empty
+                if (distances == 0)
+                {
+                    out << std::setw(16) << "-" << std::setw(12) << "-" << std::setw(12) << "-" << std::setw(12) << "-" << "\n";
+                    continue;
+                }
+                out << std::setw(16) << distances << std::setprecision(3) << std::setw(12) << cycles / distances
+                    << std::setw(12) << llcMisses / distances << std::setw(12) << branchMisses / distances << "\n";
+            }
+            out.flags(flags);
+            out.precision(precision);
+        }
+    };
+
+    // Adds the counts of the enclosing scope, on the calling thread, to a
+    // phase. Counts are scaled up if the kernel had to multiplex the group.
+    class Scope
+    {
+    private:
+        Phase *phase = nullptr;
+        std::uint64_t distances;
+        Sample start;
+
+    public:
+        Scope(Phase &phase, std::uint64_t distances)
+            : distances(distances)
+        {
+            if (Profiler::instance().isEnabled() && ThreadCounters::current().read(start))
+            {
+                this->phase = &phase;
+            }
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        ~Scope()
+        {
+            Sample stop;
+            if (phase == nullptr || !ThreadCounters::current().read(stop))
+            {
+                return;
+            }
+            std::uint64_t running = stop.timeRunning - start.timeRunning;
+            std::uint64_t enabledTime = stop.timeEnabled - start.timeEnabled;
+            double scale = running == 0 ? 0.0 : static_cast<double>(enabledTime) / running;
+            for (int event = 0; event < NumEvents; event++)
+            {
+                double delta = static_cast<double>(stop.values[event] - start.values[event]) * scale;
+                phase->values[event].fetch_add(static_cast<std::uint64_t>(delta), std::memory_order_relaxed);
+            }
+            phase->calls.fetch_add(1, std::memory_order_relaxed);
+            phase->distances.fetch_add(distances, std::memory_order_relaxed);
+        }
+    };
+}
+
+#define PERF_COUNTERS_CONCAT_(a, b) a##b
+#define PERF_COUNTERS_CONCAT(a, b) PERF_COUNTERS_CONCAT_(a, b)
+
+// Counts the rest of the enclosing scope under phase name, as distances
+// distance computations. The phase is looked up once per call site, so name
+// must not change between calls; pick between phases with separate scopes.
+#define NN_PERF_SCOPE(name, distances)                                                                              \
+    static PerfCounters::Phase &PERF_COUNTERS_CONCAT(perfPhase_, __LINE__) = PerfCounters::Profiler::instance().phase(name); \
+    PerfCounters::Scope PERF_COUNTERS_CONCAT(perfScope_, __LINE__)(PERF_COUNTERS_CONCAT(perfPhase_, __LINE__), (distances))
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef PROJECTION_FOREST_H
+#define PROJECTION_FOREST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+#include "DistanceKernels.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
+
+// Approximate nearest neighbors from a random projection forest, for
+// datasets too large to scan every row for every prediction. Each tree
+// splits its rows in half at the median of their projections onto a random
+// Gaussian direction until leaves are small. A query descends every tree to
+// one leaf and is compared exactly with the rows of those leaves only, so it
+// costs about trees x (depth + leaf size) distances instead of N. Near rows
+// usually share a leaf with the query in some tree, but the true nearest
+// row is missed now and then; more trees and larger leaves miss it less.
+struct ApproximateOptions
+{
+    bool enabled = false;
+    std::size_t numTrees = 8;              // The recall knob: cost grows linearly with it
+    std::size_t leafSize = 32;             // Rows per leaf at most; larger leaves also raise recall
+    std::uint64_t seed = 1;                // Fixes the projections, so results are reproducible
+    std::size_t calibrationSample = 1000;  // Instances the calibration report compares on
+};
+
+class ProjectionForest
+{
+private:
+    struct Node
+    {
+        std::size_t begin = 0; // Rows [begin, end) of the tree's order
+        std::size_t end = 0;
+        std::size_t direction = 0; // Offset of the projection in directions
+        double splitValue = 0.0;
+        std::int64_t left = -1; // Children, or -1 for a leaf
+        std::int64_t right = -1;
+    };
+
+    struct Tree
+    {
+        std::vector<std::size_t> rows; // Dataset rows, grouped by leaf
+        std::vector<Node> nodes;
+        std::vector<double> directions; // numDimensions values per inner node
+    };
+
+    std::size_t numDimensions = 0;
+    std::size_t leafSize = 0;
+    std::vector<double> points; // Row-major, numDimensions values per dataset row
+    std::vector<Tree> trees;
+
+    double project(const double *direction, const double *point) const
+    {
+        double projection = 0.0;
+        for (std::size_t j = 0; j < numDimensions; j++)
+        {
+            projection += direction[j] * point[j];
+        }
+        return projection;
+    }
+
+    std::int64_t build(Tree &tree, std::size_t begin, std::size_t end, std::mt19937_64 &random,
+                       std::vector<std::pair<double, std::size_t>> &projections)
+    {
+        Node node;
+        node.begin = begin;
+        node.end = end;
+        std::int64_t nodeIndex = static_cast<std::int64_t>(tree.nodes.size());
+        tree.nodes.push_back(node);
+        if (end - begin <= leafSize)
+        {
+            return nodeIndex;
+        }
+
+        std::normal_distribution<double> gaussian;
+        node.direction = tree.directions.size();
+        for (std::size_t j = 0; j < numDimensions; j++)
+        {
+            tree.directions.push_back(gaussian(random));
+        }
+        const double *direction = tree.directions.data() + node.direction;
+
+        // Split at the median projection; rows are halved by position, so
+        // duplicate rows still end up in leaves of bounded size
+        projections.clear();
+        for (std::size_t p = begin; p < end; p++)
+        {
+            projections.emplace_back(project(direction, points.data() + tree.rows[p] * numDimensions), tree.rows[p]);
+        }
+        std::size_t half = (end - begin) / 2;
+        std::nth_element(projections.begin(), projections.begin() + half, projections.end());
+        node.splitValue = projections[half].first;
+        for (std::size_t p = begin; p < end; p++)
+        {
+            tree.rows[p] = projections[p - begin].second;
+        }
+
+        node.left = build(tree, begin, begin + half, random, projections);
+        node.right = build(tree, begin + half, end, random, projections);
+        tree.nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+public:
+    // Builds options.numTrees trees over the selected columns, in parallel
+    // on pool. Each tree draws from its own generator, so the forest does not
+    // depend on the number of threads.
+    ProjectionForest(const ColumnSelection &selection, const ApproximateOptions &options, ThreadPool &pool)
+        : numDimensions(selection.numFeatures), leafSize(std::max<std::size_t>(options.leafSize, 1)),
+          trees(options.numTrees)
+    {
+        NN_METRIC_TIMER("projection_forest_build");
+        std::size_t numInstances = selection.data->getNumInstances();
+        points.resize(numInstances * numDimensions);
+        for (std::size_t j = 0; j < numDimensions; j++)
+        {
+            const double *column = selection.column(j);
+            for (std::size_t i = 0; i < numInstances; i++)
+            {
+                points[i * numDimensions + j] = column[i];
+            }
+        }
+
+        pool.parallelFor(trees.size(), 1, [&](std::size_t begin, std::size_t end, std::size_t)
+                         {
+                             std::vector<std::pair<double, std::size_t>> projections;
+                             for (std::size_t t = begin; t < end; t++)
+                             {
+                                 std::mt19937_64 random(options.seed * 0x9E3779B97F4A7C15ull + t);
+                                 trees[t].rows.resize(numInstances);
+                                 for (std::size_t i = 0; i < numInstances; i++)
+                                 {
+                                     trees[t].rows[i] = i;
+                                 }
+                                 if (numInstances > 0)
+                                 {
+                                     build(trees[t], 0, numInstances, random, projections);
+                                 }
+                             } });
+    }
+
+    // Nearest row to query (one value per selected column) among the rows
+    // sharing a leaf with it in any tree, skipping the row at excluded.
+    // Distances are summed like the brute force kernels and ties go to the
+    // lowest row index, so when the true nearest row is among the
+    // candidates the answer is exactly FindNearest's.
+    NeighborMatch findNearest(const double *query, std::size_t excluded = NeighborMatch::NoNeighbor) const
+    {
+        thread_local std::vector<std::size_t> candidates;
+        candidates.clear();
+        for (const Tree &tree : trees)
+        {
+            if (tree.nodes.empty())
+            {
+                continue;
+            }
+            const Node *node = &tree.nodes[0];
+            while (node->left >= 0)
+            {
+                double projection = project(tree.directions.data() + node->direction, query);
+                node = &tree.nodes[projection < node->splitValue ? node->left : node->right];
+            }
+            candidates.insert(candidates.end(), tree.rows.begin() + node->begin, tree.rows.begin() + node->end);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        NeighborMatch best;
+        for (std::size_t index : candidates)
+        {
+            if (index == excluded)
+            {
+                continue;
+            }
+            const double *point = points.data() + index * numDimensions;
+            double distance = 0.0;
+            for (std::size_t j = 0; j < numDimensions; j++)
+            {
+                double difference = query[j] - point[j];
+                distance += difference * difference;
+            }
+            if (distance < best.distance)
+            {
+                best.distance = distance;
+                best.index = index;
+            }
+        }
+        NN_METRIC_COUNT("distance_rows", candidates.size());
+        return best;
+    }
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef RACING_H
+#define RACING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+// Candidates of a search level are raced: each is scored on the same
+// random sample of held-out instances, the sample grows geometrically, and
+// after every round a candidate whose upper confidence bound is below the
+// leader's lower bound is eliminated. Accuracy is a mean of 0/1 outcomes,
+// so the intervals come from Hoeffding's inequality or, tighter when the
+// accuracy is near 0 or 1, the empirical Bernstein bound of Maurer and
+// Pontil. The level's confidence is split evenly over every candidate and
+// round (a union bound), so all eliminations are right together with at
+// least that probability. Sampling without replacement from the dataset
+// only concentrates faster than the bounds assume.
+enum class RaceBound
+{
+    Hoeffding,
+    Bernstein
+};
+
+inline const char *RaceBoundName(RaceBound bound)
+{
+    return bound == RaceBound::Bernstein ? "bernstein" : "hoeffding";
+}
+
+inline RaceBound ParseRaceBound(const std::string &name)
+{
+    if (name == "hoeffding")
+    {
+        return RaceBound::Hoeffding;
+    }
+    if (name == "bernstein")
+    {
+        return RaceBound::Bernstein;
+    }
+    throw std::runtime_error("Unknown race bound: " + name);
+}
+
+struct RaceOptions
+{
+    bool enabled = false;
+    RaceBound bound = RaceBound::Hoeffding;
+    double confidence = 0.95;       // That no candidate is eliminated wrongly, per level
+    std::size_t initialSample = 64; // Held-out instances in the first round; each round doubles it
+    std::uint64_t seed = 1;         // Fixes the order instances are sampled in
+};
+
+// Half-width of the interval around mean, estimated from n 0/1 outcomes,
+// that holds the true mean with probability at least 1 - delta
+inline double ConfidenceRadius(RaceBound bound, double mean, std::size_t n, double delta)
+{
+    double logTerm = std::log(2.0 / delta);
+    if (bound == RaceBound::Bernstein && n > 1)
+    {
+        double variance = mean * (1.0 - mean) * n / (n - 1);
+        return std::sqrt(2.0 * variance * logTerm / n) + 7.0 * logTerm / (3.0 * (n - 1));
+    }
+    return std::sqrt(logTerm / (2.0 * n));
+}
+
+struct RaceResult
+{
+    std::vector<char> eliminated;  // Per candidate
+    std::vector<double> estimates; // Accuracy on the instances each candidate was scored on
+    std::vector<std::size_t> folds; // How many instances that was; all of them makes the estimate exact
+    std::size_t foldsSpent = 0;     // Summed over candidates
+};
+
+// Races numCandidates candidates over the instances 0 to numInstances - 1.
+// countCorrect(c, instances) returns how many of instances candidate c
+// classifies correctly. The race ends once a single candidate is left or
+// the sample is the whole dataset, when the survivors' estimates are their
+// exact accuracies, so it never makes more predictions than scoring every
+// candidate in full. Candidates run in parallel on the pool.
+template <typename CountCorrect>
+RaceResult RaceCandidates(ThreadPool &pool, std::size_t numCandidates, std::size_t numInstances,
+                          const RaceOptions &options, std::uint64_t seed, const CountCorrect &countCorrect)
+{
+    if (!(options.confidence > 0.0 && options.confidence < 1.0) || options.initialSample == 0)
+    {
+        throw std::runtime_error("Racing needs a confidence between 0 and 1 and a nonempty first sample");
+    }
+
+    RaceResult race;
+    race.eliminated.assign(numCandidates, 0);
+    race.estimates.assign(numCandidates, 0.0);
+    race.folds.assign(numCandidates, 0);
+    if (numCandidates < 2)
+    {
+        return race;
+    }
+
+    std::vector<std::size_t> order(numInstances);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937_64 random(seed);
+    std::shuffle(order.begin(), order.end(), random);
+
+    std::size_t numRounds = 1;
+    for (std::size_t sample = options.initialSample; sample < numInstances; sample *= 2)
+    {
+        numRounds++;
+    }
+    double delta = (1.0 - options.confidence) / (numCandidates * numRounds);
+
+    std::vector<std::size_t> correct(numCandidates, 0);
+    std::vector<std::size_t> alive(numCandidates);
+    std::iota(alive.begin(), alive.end(), 0);
+    std::size_t sampled = 0;
+    for (std::size_t sample = options.initialSample; alive.size() > 1 && sampled < numInstances; sample *= 2)
+    {
+        std::size_t end = std::min(sample, numInstances);
+        std::vector<std::size_t> batch(order.begin() + sampled, order.begin() + end);
+        pool.parallelFor(alive.size(), 1, [&](std::size_t begin, std::size_t stop, std::size_t)
+                         {
+                             for (std::size_t a = begin; a < stop; a++)
+                             {
+                                 correct[alive[a]] += countCorrect(alive[a], batch);
+                             } });
+        race.foldsSpent += alive.size() * batch.size();
+        sampled = end;
+
+        double leaderLower = 0.0;
+        for (std::size_t c : alive)
+        {
+            race.folds[c] = sampled;
+            race.estimates[c] = static_cast<double>(correct[c]) / sampled;
+            double radius = ConfidenceRadius(options.bound, race.estimates[c], sampled, delta);
+            leaderLower = std::max(leaderLower, race.estimates[c] - radius);
+        }
+        std::vector<std::size_t> survivors;
+        for (std::size_t c : alive)
+        {
+            double radius = ConfidenceRadius(options.bound, race.estimates[c], sampled, delta);
+            if (race.estimates[c] + radius < leaderLower)
+            {
+                race.eliminated[c] = 1;
+            }
+            else
+            {
+                survivors.push_back(c);
+            }
+        }
+        alive.swap(survivors);
+    }
+    return race;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef REDUCED_PRECISION_H
+#define REDUCED_PRECISION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "Dataset.h"
+
+// How the normalized columns are stored for nearest-neighbor scans. The
+// narrower types fit two or four times as many rows in each cache line.
+enum class ValuePrecision
+{
+    Double,
+    Float32,
+    Int16
+};
+
+inline const char *ValuePrecisionName(ValuePrecision precision)
+{
+    switch (precision)
+    {
+    case ValuePrecision::Float32:
+        return "float32";
+    case ValuePrecision::Int16:
+        return "int16";
+    default:
+        return "double";
+    }
+}
+
+inline ValuePrecision ParseValuePrecision(const std::string &name)
+{
+    if (name == "double")
+    {
+        return ValuePrecision::Double;
+    }
+    if (name == "float32")
+    {
+        return ValuePrecision::Float32;
+    }
+    if (name == "int16")
+    {
+        return ValuePrecision::Int16;
+    }
+    throw std::runtime_error("Unknown precision: " + name);
+}
+
+// Fixed-point code of 1.0; a normalized value v is stored as round(v * Int16Scale)
+constexpr double Int16Scale = 32767.0;
+
+// Copies normalized columns to float, rounding each value to the nearest float
+inline BasicDataset<float> ToFloat32(const Dataset &data)
+{
+    BasicDataset<float> converted(data.getNumInstances(), data.getNumColumns());
+    for (std::size_t j = 0; j < data.getNumColumns(); j++)
+    {
+        const double *source = data.column(j);
+        float *destination = converted.column(j);
+        for (std::size_t i = 0; i < data.getNumInstances(); i++)
+        {
+            destination[i] = static_cast<float>(source[i]);
+        }
+    }
+    return converted;
+}
+
+// Quantizes normalized columns to 16-bit fixed point. Only constant columns
+// hold values outside [0, 1]; they are clamped, which keeps them constant.
+// Distances between codes are sums of squared integers, so they are exact.
+inline BasicDataset<std::int16_t> ToInt16(const Dataset &data)
+{
+    BasicDataset<std::int16_t> converted(data.getNumInstances(), data.getNumColumns());
+    for (std::size_t j = 0; j < data.getNumColumns(); j++)
+    {
+        const double *source = data.column(j);
+        std::int16_t *destination = converted.column(j);
+        for (std::size_t i = 0; i < data.getNumInstances(); i++)
+        {
+            double clamped = std::min(std::max(source[i], 0.0), 1.0);
+            destination[i] = static_cast<std::int16_t>(std::lround(clamped * Int16Scale));
+        }
+    }
+    return converted;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef SYNTHETIC_DATASET_H
+#define SYNTHETIC_DATASET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "Dataset.h"
+
+// Shape of a generated classification problem
+struct SyntheticSpec
+{
+    std::size_t numInstances = 1000;
+    std::size_t numFeatures = 20;
+    std::size_t numRelevant = 3; // Features the label depends on
+    double noise = 0.1;          // Fraction of labels flipped after the fact
+    std::uint64_t seed = 1;
+};
+
+// A generated dataset in the layout the data files have: column 0 holds
+// the class label (1 or 2), the other columns the features
+struct SyntheticDataset
+{
+    Dataset data;
+    std::vector<std::size_t> relevantFeatures; // 0-based feature indices, ascending
+};
+
+// Draws every feature uniformly from [0, 1]. The label is 2 when the
+// relevant features sum to more than half their count and 1 otherwise,
+// then flipped with probability noise, so nearest neighbor over exactly
+// the relevant features does best. The relevant features are scattered
+// among the others. The same spec always gives the same dataset.
+inline SyntheticDataset GenerateSyntheticDataset(const SyntheticSpec &spec)
+{
+    if (spec.numRelevant > spec.numFeatures)
+    {
+        throw std::runtime_error("More relevant features than features");
+    }
+
+    std::mt19937_64 random(spec.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<std::size_t> features(spec.numFeatures);
+    std::iota(features.begin(), features.end(), 0);
+    std::shuffle(features.begin(), features.end(), random);
+    SyntheticDataset generated;
+    generated.relevantFeatures.assign(features.begin(), features.begin() + spec.numRelevant);
+    std::sort(generated.relevantFeatures.begin(), generated.relevantFeatures.end());
+
+    generated.data = Dataset(spec.numInstances, spec.numFeatures + 1);
+    for (std::size_t i = 0; i < spec.numInstances; i++)
+    {
+        for (std::size_t j = 0; j < spec.numFeatures; j++)
+        {
+            generated.data.at(i, j + 1) = uniform(random);
+        }
+
+        double relevantSum = 0.0;
+        for (std::size_t j : generated.relevantFeatures)
+        {
+            relevantSum += generated.data.at(i, j + 1);
+        }
+        bool positive = relevantSum > 0.5 * spec.numRelevant;
+        if (uniform(random) < spec.noise)
+        {
+            positive = !positive;
+        }
+        generated.data.at(i, 0) = positive ? 2.0 : 1.0;
+    }
+    return generated;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that stay alive between jobs, so a parallel
+// loop costs a wake-up instead of a thread creation. The calling thread
+// takes part as worker 0; a pool of size 1 runs everything inline.
+//
+// A job's chunks are dealt out evenly into one queue per worker. Workers
+// drain their own queue from the front and, once it is empty, steal from
+// the back of the others, so uneven chunk costs still balance out.
+// parallelFor() called from inside a running job executes inline on the
+// calling worker, which lets an outer loop (e.g. candidate features) and an
+// inner loop (e.g. held-out instances) both be written as parallel loops.
+class ThreadPool
+{
+private:
+    using RangeBody = std::function<void(std::size_t begin, std::size_t end, std::size_t worker)>;
+
+    // Chunks [front, back) still owned by one worker
+    struct alignas(64) WorkQueue
+    {
+        std::mutex mutex;
+        std::size_t front = 0;
+        std::size_t back = 0;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<WorkQueue> queues;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    std::size_t generation = 0; // Bumped once per job so sleeping workers notice it
+    std::size_t busyWorkers = 0;
+    bool stopping = false;
+
+    // The job being run
+    const RangeBody *body = nullptr;
+    std::size_t count = 0;
+    std::size_t grain = 1;
+    std::atomic<bool> abandoned{false};
+    std::exception_ptr failure;
+
+    // Which pool and worker the current thread is running a chunk for
+    static ThreadPool *&currentPool()
+    {
+        static thread_local ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static std::size_t &currentWorkerIndex()
+    {
+        static thread_local std::size_t worker = 0;
+        return worker;
+    }
+
+    bool popOwn(std::size_t worker, std::size_t &chunk)
+    {
+        WorkQueue &queue = queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.front == queue.back)
+        {
+            return false;
+        }
+        chunk = queue.front++;
+        return true;
+    }
+
+    bool steal(std::size_t thief, std::size_t &chunk)
+    {
+        for (std::size_t offset = 1; offset < queues.size(); offset++)
+        {
+            WorkQueue &queue = queues[(thief + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.front != queue.back)
+            {
+                chunk = --queue.back;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs chunks from this worker's queue, then steals until none are left
+    void runChunks(std::size_t worker)
+    {
+        currentPool() = this;
+        currentWorkerIndex() = worker;
+        std::size_t chunk;
+        while (!abandoned && (popOwn(worker, chunk) || steal(worker, chunk)))
+        {
+            std::size_t begin = chunk * grain;
+            try
+            {
+                (*body)(begin, std::min(begin + grain, count), worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!failure)
+                {
+                    failure = std::current_exception();
+                }
+                abandoned = true;
+            }
+        }
+        currentPool() = nullptr;
+    }
+
+    void workerLoop(std::size_t worker)
+    {
+        std::size_t seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobReady.wait(lock, [&]
+                              { return stopping || generation != seenGeneration; });
+                if (stopping)
+                {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            runChunks(worker);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0)
+            {
+                jobDone.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(std::size_t numThreads)
+        : queues(std::max<std::size_t>(numThreads, 1))
+    {
+        for (std::size_t worker = 1; worker < std::max<std::size_t>(numThreads, 1); worker++)
+        {
+            threads.emplace_back(&ThreadPool::workerLoop, this, worker);
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    std::size_t size() const
+    {
+        return threads.size() + 1;
+    }
+
+    // True while the calling thread is running a chunk of one of this pool's jobs
+    bool insideJob() const
+    {
+        return currentPool() == this;
+    }
+
+    // Runs rangeBody over [0, itemCount) in chunks of chunkSize and returns
+    // once every chunk is done. The worker argument is in [0, size()) and is
+    // unique among the chunks running at the same moment, so it can index
+    // per-worker scratch space. Rethrows the first exception a chunk threw.
+    // Only one thread outside the pool may start jobs at a time.
+    void parallelFor(std::size_t itemCount, std::size_t chunkSize, const RangeBody &rangeBody)
+    {
+        if (itemCount == 0)
+        {
+            return;
+        }
+        if (insideJob())
+        {
+            rangeBody(0, itemCount, currentWorkerIndex());
+            return;
+        }
+        if (threads.empty() || itemCount <= chunkSize)
+        {
+            rangeBody(0, itemCount, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            body = &rangeBody;
+            count = itemCount;
+            grain = std::max<std::size_t>(chunkSize, 1);
+            std::size_t numChunks = (count + grain - 1) / grain;
+            for (std::size_t worker = 0; worker < queues.size(); worker++)
+            {
+                std::lock_guard<std::mutex> queueLock(queues[worker].mutex);
+                queues[worker].front = numChunks * worker / queues.size();
+                queues[worker].back = numChunks * (worker + 1) / queues.size();
+            }
+            abandoned = false;
+            failure = nullptr;
+            busyWorkers = threads.size();
+            generation++;
+        }
+        jobReady.notify_all();
+
+        runChunks(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        jobDone.wait(lock, [&]
+                     { return busyWorkers == 0; });
+        body = nullptr;
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef VALIDATION_PLAN_H
+#define VALIDATION_PLAN_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// How a subset's accuracy is estimated. Leave-one-out predicts every
+// instance from all the others. Stratified k-fold splits the instances into
+// k folds with the class mix of the whole and predicts each fold from the
+// other k - 1. Repeated holdout predicts a random stratified test fraction
+// from the rest, several times over. With 1-nearest neighbor every
+// prediction scans the whole training side, so k-fold costs (k - 1) / k of
+// leave-one-out; only holdout, which predicts fewer instances from fewer
+// rows, is much cheaper.
+enum class ValidationStrategy
+{
+    LeaveOneOut,
+    StratifiedKFold,
+    RepeatedHoldout
+};
+
+struct ValidationOptions
+{
+    ValidationStrategy strategy = ValidationStrategy::LeaveOneOut;
+    std::size_t folds = 10;        // k of k-fold
+    std::size_t repetitions = 5;   // Holdout splits, each scored once
+    double holdoutFraction = 0.3;  // Share of each class held out per split
+    std::uint64_t seed = 1;        // Fixes the folds, so results are reproducible
+};
+
+inline const char *ValidationStrategyName(ValidationStrategy strategy)
+{
+    switch (strategy)
+    {
+    case ValidationStrategy::StratifiedKFold:
+        return "kfold";
+    case ValidationStrategy::RepeatedHoldout:
+        return "holdout";
+    default:
+        return "loocv";
+    }
+}
+
+inline ValidationStrategy ParseValidationStrategy(const std::string &name)
+{
+    if (name == "loocv")
+    {
+        return ValidationStrategy::LeaveOneOut;
+    }
+    if (name == "kfold")
+    {
+        return ValidationStrategy::StratifiedKFold;
+    }
+    if (name == "holdout")
+    {
+        return ValidationStrategy::RepeatedHoldout;
+    }
+    throw std::runtime_error("Unknown validation strategy: " + name);
+}
+
+// e.g. "stratified 10-fold cross-validation (seed 1)"
+inline std::string DescribeValidation(const ValidationOptions &options)
+{
+    switch (options.strategy)
+    {
+    case ValidationStrategy::StratifiedKFold:
+        return "stratified " + std::to_string(options.folds) + "-fold cross-validation (seed " +
+               std::to_string(options.seed) + ")";
+    case ValidationStrategy::RepeatedHoldout:
+        return std::to_string(options.repetitions) + " stratified holdout splits of " +
+               std::to_string(static_cast<int>(std::lround(options.holdoutFraction * 100))) + "% (seed " +
+               std::to_string(options.seed) + ")";
+    default:
+        return "leave-one-out cross-validation";
+    }
+}
+
+// One round of prediction: the testing instances are each classified by
+// their nearest neighbor among the training instances. Both are ascending,
+// so ties still go to the lowest instance index.
+struct ValidationFold
+{
+    std::vector<std::size_t> training;
+    std::vector<std::size_t> testing;
+};
+
+// Instances of each class, ascending by label and then by index
+inline std::vector<std::vector<std::size_t>> GroupByClass(const std::vector<int> &labels)
+{
+    std::map<int, std::vector<std::size_t>> classes;
+    for (std::size_t i = 0; i < labels.size(); i++)
+    {
+        classes[labels[i]].push_back(i);
+    }
+    std::vector<std::vector<std::size_t>> groups;
+    for (auto &entry : classes)
+    {
+        groups.push_back(std::move(entry.second));
+    }
+    return groups;
+}
+
+// Splits the instances into training and testing sides by fold id: the
+// instances whose id is testFold are tested, the rest train
+inline ValidationFold SplitByFold(const std::vector<std::size_t> &foldOf, std::size_t testFold)
+{
+    ValidationFold fold;
+    for (std::size_t i = 0; i < foldOf.size(); i++)
+    {
+        (foldOf[i] == testFold ? fold.testing : fold.training).push_back(i);
+    }
+    return fold;
+}
+
+// The rounds of prediction the options describe for these labels; none for
+// leave-one-out, which Validator runs over the whole dataset directly. The
+// same labels and options always give the same folds.
+inline std::vector<ValidationFold> BuildValidationFolds(const std::vector<int> &labels, const ValidationOptions &options)
+{
+    std::vector<ValidationFold> folds;
+    std::size_t numInstances = labels.size();
+    std::mt19937_64 random(options.seed);
+    std::vector<std::vector<std::size_t>> groups = GroupByClass(labels);
+
+    if (options.strategy == ValidationStrategy::StratifiedKFold)
+    {
+        if (options.folds < 2 || options.folds > numInstances)
+        {
+            throw std::runtime_error("k-fold validation needs between 2 and " + std::to_string(numInstances) + " folds");
+        }
+        // Dealing each shuffled class round-robin, continuing from where the
+        // previous class stopped, keeps both fold sizes and class mix even
+        std::vector<std::size_t> foldOf(numInstances);
+        std::size_t next = 0;
+        for (std::vector<std::size_t> &group : groups)
+        {
+            std::shuffle(group.begin(), group.end(), random);
+            for (std::size_t i : group)
+            {
+                foldOf[i] = next++ % options.folds;
+            }
+        }
+        for (std::size_t f = 0; f < options.folds; f++)
+        {
+            folds.push_back(SplitByFold(foldOf, f));
+        }
+    }
+    else if (options.strategy == ValidationStrategy::RepeatedHoldout)
+    {
+        if (options.repetitions == 0 || !(options.holdoutFraction > 0.0 && options.holdoutFraction < 1.0))
+        {
+            throw std::runtime_error("Holdout validation needs at least one split and a fraction between 0 and 1");
+        }
+        for (std::size_t r = 0; r < options.repetitions; r++)
+        {
+            std::vector<std::size_t> heldOut(numInstances, 0);
+            for (std::vector<std::size_t> &group : groups)
+            {
+                std::shuffle(group.begin(), group.end(), random);
+                std::size_t testCount = static_cast<std::size_t>(std::lround(options.holdoutFraction * group.size()));
+                for (std::size_t t = 0; t < testCount; t++)
+                {
+                    heldOut[group[t]] = 1;
+                }
+            }
+            ValidationFold fold = SplitByFold(heldOut, 1);
+            if (fold.testing.empty() || fold.training.empty())
+            {
+                throw std::runtime_error("Holdout fraction leaves no instances to train or test on");
+            }
+            folds.push_back(std::move(fold));
+        }
+    }
+    return folds;
+}
+
+#endif
@@ -1,12 +1,12 @@
 #include <iostream>
 #include <vector>
-#include <set>
 #include <random>
 #include <iomanip>
+#include "FeatureSubset.h"
 
 using namespace std;
 
-double EvaluateFeatureSubset(const set<int> &features)
+double EvaluateFeatureSubset(const FeatureSubset &features)
 {
     static random_device randomDevice;
     static mt19937 mersenneTwisterGenerator(randomDevice());
@@ -14,24 +14,26 @@ double EvaluateFeatureSubset(const set<int> &features)
     return uniformDistribution(mersenneTwisterGenerator);
 }
 
-void PrintFeatureSet(const set<int> &features)
+void PrintFeatureSet(const FeatureSubset &features)
 {
     cout << "{";
-    for (set<int>::iterator iterator = features.begin(); iterator != features.end(); iterator++)
+    bool first = true;
+    for (size_t feature : features)
     {
-        cout << *iterator;
-        if (next(iterator) != features.end())
+        if (!first)
         {
             cout << ",";
         }
+        cout << feature;
+        first = false;
     }
     cout << "}";
 }
 
 void ForwardSelection(int totalFeatures)
 {
-    set<int> currentFeatureSet;
-    set<int> bestOverallFeatureSet;
+    FeatureSubset currentFeatureSet;
+    FeatureSubset bestOverallFeatureSet;
     double bestOverallAccuracy = EvaluateFeatureSubset(currentFeatureSet);
     cout << "Using no features and \"random\" evaluation, I get an accuracy of" << fixed << setprecision(1) << bestOverallAccuracy << "%\n";
     cout << "Beginning search." << endl;
@@ -40,15 +42,14 @@ void ForwardSelection(int totalFeatures)
     {
         int bestFeatureToAdd = -1;
         double bestAccuracyThisLevel = 0.0;
-        set<int> bestFeatureSetThisLevel;
+        FeatureSubset bestFeatureSetThisLevel;
 
         // Attempt to add features not in the set
         for (int candidateFeature = 1; candidateFeature <= totalFeatures; candidateFeature++)
         {
-            if (currentFeatureSet.find(candidateFeature) == currentFeatureSet.end())
+            if (!currentFeatureSet.contains(candidateFeature))
             {
-                set<int> testFeatureSet = currentFeatureSet;
-                testFeatureSet.insert(candidateFeature);
+                FeatureSubset testFeatureSet = currentFeatureSet.with(candidateFeature);
 
                 double currentAccuracy = EvaluateFeatureSubset(testFeatureSet);
                 cout << "Using feature(s)";
@@ -90,14 +91,14 @@ void ForwardSelection(int totalFeatures)
 
 void BackwardElimination(int totalFeatures)
 {
-    set<int> currentFeatureSet;
+    FeatureSubset currentFeatureSet;
 
     for (int featureIndex = 1; featureIndex <= totalFeatures; featureIndex++)
     {
-        currentFeatureSet.insert(featureIndex);
+        currentFeatureSet.add(featureIndex);
     }
 
-    set<int> bestOverallFeatureSet = currentFeatureSet;
+    FeatureSubset bestOverallFeatureSet = currentFeatureSet;
     double bestOverallAccuracy = EvaluateFeatureSubset(currentFeatureSet);
     cout << "Using no features and \"random\" evaluation, I get an accuracy of" << fixed << setprecision(1) << bestOverallAccuracy << "%\n";
     cout << "Beginning search." << endl;
@@ -106,13 +107,12 @@ void BackwardElimination(int totalFeatures)
     {
         int bestFeatureToRemove = -1;
         double bestAccuracyThisLevel = 0.0;
-        set<int> bestFeatureSetThisLevel;
+        FeatureSubset bestFeatureSetThisLevel;
 
         // Try to remove each feature that's in the set
-        for (set<int>::iterator featureIterator = currentFeatureSet.begin(); featureIterator != currentFeatureSet.end(); featureIterator++)
+        for (size_t feature : currentFeatureSet)
         {
-            set<int> testFeatureSet = currentFeatureSet;
-            testFeatureSet.erase(*featureIterator);
+            FeatureSubset testFeatureSet = currentFeatureSet.without(feature);
             double currentAccuracy = EvaluateFeatureSubset(testFeatureSet);
             cout << "Using feature(s)";
             PrintFeatureSet(testFeatureSet);
@@ -121,7 +121,7 @@ void BackwardElimination(int totalFeatures)
             if (currentAccuracy > bestAccuracyThisLevel)
             {
                 bestAccuracyThisLevel = currentAccuracy;
-                bestFeatureToRemove = *featureIterator;
+                bestFeatureToRemove = feature;
                 bestFeatureSetThisLevel = testFeatureSet;
             }
         }
@@ -156,6 +156,12 @@ int main()
     cout << "Please enter total number of features: ";
     int totalFeatures;
     cin >> totalFeatures;
+    // Features are numbered from 1
+    if (totalFeatures >= static_cast<int>(FeatureSubset::Capacity))
+    {
+        cout << "At most " << FeatureSubset::Capacity - 1 << " features are supported\n";
+        return 1;
+    }
 
     cout << "Type the number of the algorithm you want to run.\n";
     cout << "1) Forward Selection\n";
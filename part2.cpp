@@ -2,35 +2,43 @@
 #include <cmath>
 #include <stdexcept>
 #include <algorithm>
-#include <chrono>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <iomanip>
 #include <string>
 #include <limits>
+#include <thread>
+#include "Dataset.h"
+#include "DatasetCache.h"
+#include "FeatureSubset.h"
+#include "Metrics.h"
 using namespace std;
 
 class NearestNeighborClassifier
 {
 private:
-    vector<vector<double>> trainingData;
+    Dataset trainingData;
     vector<int> trainingLabels;
 
 public:
-    void Train(const vector<vector<double>> &instances, const vector<int> &labels)
+    void Train(const Dataset &instances, const vector<int> &labels)
     {
         trainingData = instances;
         trainingLabels = labels;
     }
 
-    void TrainWithIDs(const vector<int> &instanceIDs, const vector<vector<double>> &fullDataset, const vector<int> &allLabels)
+    void TrainWithIDs(const vector<int> &instanceIDs, const Dataset &fullDataset, const vector<int> &allLabels)
     {
-        trainingData.clear();
+        trainingData = Dataset(instanceIDs.size(), fullDataset.getNumColumns());
         trainingLabels.clear();
+        for (size_t j = 0; j < fullDataset.getNumColumns(); j++)
+        {
+            for (size_t i = 0; i < instanceIDs.size(); i++)
+            {
+                trainingData.at(i, j) = fullDataset.at(instanceIDs[i], j);
+            }
+        }
         for (int id : instanceIDs)
         {
-            trainingData.push_back(fullDataset[id]);
             trainingLabels.push_back(allLabels[id]);
         }
     }
@@ -45,12 +53,12 @@ public:
         double minDistance = numeric_limits<double>::max(); // Initialize to max possible value
         int nearestLabel = trainingLabels[0];
 
-        for (size_t i = 0; i < trainingData.size(); i++)
+        for (size_t i = 0; i < trainingData.getNumInstances(); i++)
         {
             double distance = 0.0;
             for (size_t j = 0; j < instance.size(); j++)
             {
-                double difference = instance[j] - trainingData[i][j];
+                double difference = instance[j] - trainingData.at(i, j);
                 distance += difference * difference;
             }
 
@@ -64,16 +72,16 @@ public:
         return nearestLabel;
     }
 
-    int TestWithID(int instanceID, const vector<vector<double>> &fullDataset) const
+    int TestWithID(int instanceID, const Dataset &fullDataset) const
     {
-        return Test(fullDataset[instanceID]);
+        return Test(fullDataset.row(instanceID));
     }
 };
 
 class Validator
 {
 private:
-    vector<vector<double>> normalizedData;
+    const Dataset normalizedData;
     vector<int> labels;
     NearestNeighborClassifier *classifier;
 
@@ -82,78 +90,51 @@ private:
     Validator &operator=(const Validator &) = delete;
 
 public:
-    Validator(const vector<vector<double>> &data, const vector<int> &labels)
+    // Takes labels and features that ReadData has already normalized
+    Validator(const PreparedDataset &data)
+        : normalizedData(data.features), labels(data.labels)
     {
-        this->normalizedData = normalizeData(data);
-        this->labels = labels;
         classifier = new NearestNeighborClassifier();
     }
 
-    vector<vector<double>> normalizeData(const vector<vector<double>> &data)
-    {
-        auto start = high_resolution_clock::now();
-        vector<vector<double>> normalizedData = data;
-        size_t numInstances = data.size();
-        size_t numFeatures = data[0].size();
-
-        // Normalize each feature (column)
-        for (size_t j = 0; j < numFeatures; ++j)
-        {
-            double minVal = data[0][j];
-            double maxVal = data[0][j];
-
-            // Find min and max for this feature
-            for (size_t i = 0; i < numInstances; ++i)
-            {
-                minVal = min(minVal, data[i][j]);
-                maxVal = max(maxVal, data[i][j]);
-            }
-
-            // Normalize this feature for all instances
-            if (maxVal > minVal)
-            {
-                for (size_t i = 0; i < numInstances; ++i)
-                {
-                    normalizedData[i][j] = (data[i][j] - minVal) / (maxVal - minVal);
-                }
-            }
-        }
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start);
-        cout << "Data normalization duration: " << duration.count() << "ms" << endl;
-        return normalizedData;
-    }
-
-    double evaluate(const vector<size_t> &featureSubset)
+    double evaluate(const FeatureSubset &featureSubset)
     {
-        auto start = high_resolution_clock::now();
+        NN_METRIC_TIMER("evaluate");
         int correctPredictions = 0;
-        size_t numInstances = normalizedData.size();
+        size_t numInstances = normalizedData.getNumInstances();
 
         for (size_t i = 0; i < numInstances; i++)
         {
             vector<double> instance;
             for (size_t j : featureSubset)
             {
-                instance.push_back(normalizedData[i][j]);
+                instance.push_back(normalizedData.at(i, j));
             }
 
-            vector<vector<double>> trainData;
+            Dataset trainData(numInstances - 1, featureSubset.size());
             vector<int> trainLabels;
-            for (int k = 0; k < numInstances; k++)
+            size_t f = 0;
+            for (size_t feature : featureSubset)
             {
-                if (k != i)
+                const double *source = normalizedData.column(feature);
+                double *destination = trainData.column(f++);
+                for (size_t k = 0, row = 0; k < numInstances; k++)
                 {
-                    vector<double> trainInstance;
-                    for (size_t j : featureSubset)
+                    if (k != i)
                     {
-                        trainInstance.push_back(normalizedData[k][j]);
+                        destination[row++] = source[k];
                     }
-                    trainData.push_back(trainInstance);
+                }
+            }
+            for (size_t k = 0; k < numInstances; k++)
+            {
+                if (k != i)
+                {
                     trainLabels.push_back(labels[k]);
                 }
             }
 
+            NN_METRIC_COUNT("folds", 1);
             classifier->Train(trainData, trainLabels);
             int predictedLabel = classifier->Test(instance);
             if (predictedLabel == labels[i])
@@ -162,72 +143,36 @@ public:
                 
             }
         }
-        auto stop = high_resolution_clock::now();
-        auto duration = duration_cast<milliseconds>(stop - start);
-        cout << "Data validation duration: " << duration.count() << "ms" << endl;
         return (double)correctPredictions / numInstances;
     }
 };
 
-vector<vector<double>> ReadData(const string &filename)
+// Parses and normalizes a dataset, or maps it from its binary cache when
+// the file has not changed since the cache was built
+PreparedDataset ReadData(const string &filename, ThreadPool &pool)
 {
-    auto start = high_resolution_clock::now();
-    vector<vector<double>> data;
-    ifstream file(filename);
-
-    if (file.is_open())
-    {
-        string line;
-        while (getline(file, line))
-        {
-            istringstream iss(line);
-            vector<double> instance;
-            double value;
-            while (iss >> value)
-            {
-                instance.push_back(value);
-            }
-
-            if (!instance.empty())
-            {
-                data.push_back(instance);
-            }
-        }
-    }
-
-    file.close();
-    auto stop = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(stop - start);
-    cout << "Data parsing duration: " << duration.count() << "ms" << endl;
-    return data;
+    return LoadPreparedDataset(filename, 0, true, pool);
 }
 
 int main()
 {
-    vector<vector<double>> smallData = ReadData("small-test-dataset.txt");
-    vector<int> labels;
-    vector<vector<double>> largeData = ReadData("large-test-dataset.txt");
-    vector<int> labelsL;
+    ThreadPool pool(thread::hardware_concurrency());
+    PreparedDataset smallData = ReadData("small-test-dataset.txt", pool);
+    PreparedDataset largeData = ReadData("large-test-dataset.txt", pool);
 
-    for (const auto &instance : smallData)
-    {
-        labels.push_back(static_cast<int>(instance[0]));
-    }
+    // Feature indices, not counting the label column
+    FeatureSubset featureSubset = {2, 4, 6};
+    FeatureSubset featureSubsetL = {0, 14, 26};
 
-    for (const auto &instance : largeData)
-    {
-        labelsL.push_back(static_cast<int>(instance[0]));
-    }
-
-    vector<size_t> featureSubset = {3, 5, 7};
-    vector<size_t> featureSubsetL = {1, 15, 27};
-
-    Validator validator(smallData, labels);
-    Validator validatorL(largeData, labelsL);
+    Validator validator(smallData);
+    Validator validatorL(largeData);
 
     double accuracy = validator.evaluate(featureSubset);
     double accuracyL = validatorL.evaluate(featureSubsetL);
 
     cout << "Accuracy: " << accuracy << endl;
-    cout << "Accuracy for large dataset: " << accuracyL;
+    cout << "Accuracy for large dataset: " << accuracyL << endl;
+
+    // Where the time went: parsing or cache loading, normalization, validation
+    Metrics::WriteSummary(cout);
 }
@@ -3,274 +3,2393 @@
 #include <stdexcept>
 #include <algorithm>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <iomanip>
 #include <string>
 #include <limits>
-#include <set>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <mutex>
+#include "Dataset.h"
+#include "DistanceKernels.h"
+#include "BlockedNeighbors.h"
+#include "ThreadPool.h"
+#include "KdTree.h"
+#include "ProjectionForest.h"
+#include "NeighborVoting.h"
+#include "DataParser.h"
+#include "DatasetCache.h"
+#include "ColumnStore.h"
+#include "ReducedPrecision.h"
+#include "EvaluationCache.h"
+#include "FeatureSubset.h"
+#include "ValidationPlan.h"
+#include "Racing.h"
+#include "SyntheticDataset.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
 using namespace std;
 
-// The NearestNeighborClassifier implements core classification functionality
-class NearestNeighborClassifier
+// The NearestNeighborClassifier implements core classification functionality
+class NearestNeighborClassifier
+{
+private:
+    Dataset trainingData;
+    vector<int> trainingLabels;
+
+    // Non-owning view set up by TrainView; nothing is copied
+    const Dataset *viewData = nullptr;
+    const vector<int> *viewLabels = nullptr;
+    const vector<size_t> *viewFeatures = nullptr;
+    const KdTree *viewIndex = nullptr; // Optional spatial index over the same view
+    mutable vector<double> queryValues; // Held-out row gathered over the view's features
+
+    bool earlyAbandon = false;
+    mutable ScanCounters scanCounters; // Work saved by early abandoning, across all tests
+
+    NeighborMatch findNearest(const ColumnSelection &selection, const double *query, size_t excluded) const
+    {
+        if (earlyAbandon)
+        {
+            return FindNearestEarlyAbandon(selection, query, excluded, scanCounters);
+        }
+        return FindNearest(selection, query, excluded);
+    }
+
+public:
+    // Stops summing a training row's distance once it exceeds the nearest
+    // distance found so far. Predictions are unchanged.
+    void SetEarlyAbandon(bool enabled)
+    {
+        earlyAbandon = enabled;
+    }
+
+    const ScanCounters &GetScanCounters() const
+    {
+        return scanCounters;
+    }
+
+    void Train(const Dataset &instances, const vector<int> &labels)
+    {
+        trainingData = instances;
+        trainingLabels = labels;
+        viewData = nullptr;
+    }
+
+    // Trains on every row of fullDataset, reading only the columns in
+    // featureSubset. The caller keeps all three containers alive. When index
+    // is given (a KdTree built over the same columns) queries are answered
+    // from it instead of a linear scan.
+    void TrainView(const Dataset &fullDataset,
+                   const vector<int> &allLabels,
+                   const vector<size_t> &featureSubset,
+                   const KdTree *index = nullptr)
+    {
+        trainingData = Dataset();
+        trainingLabels.clear();
+        viewData = &fullDataset;
+        viewLabels = &allLabels;
+        viewFeatures = &featureSubset;
+        viewIndex = index;
+        queryValues.resize(featureSubset.size());
+    }
+
+    void TrainWithIDs(const vector<int> &instanceIDs,
+                      const Dataset &fullDataset,
+                      const vector<int> &allLabels)
+    {
+        trainingData = Dataset(instanceIDs.size(), fullDataset.getNumColumns());
+        trainingLabels.clear();
+        viewData = nullptr;
+        for (size_t j = 0; j < fullDataset.getNumColumns(); j++)
+        {
+            const double *source = fullDataset.column(j);
+            double *destination = trainingData.column(j);
+            for (size_t i = 0; i < instanceIDs.size(); i++)
+            {
+                destination[i] = source[instanceIDs[i]];
+            }
+        }
+        for (int id : instanceIDs)
+        {
+            trainingLabels.push_back(allLabels[id]);
+        }
+    }
+
+    int Test(const vector<double> &instance) const
+    {
+        if (trainingData.empty())
+        {
+            throw runtime_error("Classifier must be trained before testing!");
+        }
+        NN_PERF_SCOPE("classifier_test", trainingData.getNumInstances());
+
+        // Distances to every training row come from the widest SIMD kernel
+        // the CPU supports; see DistanceKernels.h
+        ColumnSelection selection = {&trainingData, nullptr, instance.size()};
+        NeighborMatch nearest = findNearest(selection, instance.data(), NeighborMatch::NoNeighbor);
+        if (nearest.index == NeighborMatch::NoNeighbor)
+        {
+            return trainingLabels[0];
+        }
+        return trainingLabels[nearest.index];
+    }
+
+    int TestWithID(int instanceID, const Dataset &fullDataset) const
+    {
+        return Test(fullDataset.row(instanceID));
+    }
+
+    // Classifies a row of the viewed dataset against every other row of it
+    int TestLeaveOneOut(size_t instanceID) const
+    {
+        if (viewData == nullptr || viewData->getNumInstances() < 2)
+        {
+            throw runtime_error("Classifier must be trained on a view before leave-one-out testing!");
+        }
+
+        const vector<size_t> &features = *viewFeatures;
+        for (size_t j = 0; j < features.size(); j++)
+        {
+            queryValues[j] = viewData->column(features[j])[instanceID];
+        }
+
+        NeighborMatch nearest;
+        if (viewIndex != nullptr)
+        {
+            nearest = viewIndex->findNearest(queryValues.data(), instanceID);
+        }
+        else
+        {
+            ColumnSelection selection = {viewData, features.data(), features.size()};
+            nearest = findNearest(selection, queryValues.data(), instanceID);
+        }
+        if (nearest.index == NeighborMatch::NoNeighbor)
+        {
+            return (*viewLabels)[instanceID == 0 ? 1 : 0];
+        }
+        return (*viewLabels)[nearest.index];
+    }
+};
+
+// Keeps the squared distance between every pair of instances over a feature
+// subset. Squared Euclidean distance is a sum over features, so the matrix can
+// be grown one feature column at a time instead of recomputed from scratch.
+class PairwiseDistanceMatrix
+{
+private:
+    size_t numInstances = 0;
+    vector<double> distances; // Row-major, numInstances x numInstances
+
+public:
+    void reset(size_t instanceCount)
+    {
+        numInstances = instanceCount;
+        distances.assign(numInstances * numInstances, 0.0);
+    }
+
+    size_t size() const
+    {
+        return numInstances;
+    }
+
+    const double *row(size_t i) const
+    {
+        return distances.data() + i * numInstances;
+    }
+
+    double *row(size_t i)
+    {
+        return distances.data() + i * numInstances;
+    }
+
+    // Adds one feature column's contribution to every pair
+    void addFeature(const double *column)
+    {
+        for (size_t i = 0; i < numInstances; i++)
+        {
+            double *distanceRow = distances.data() + i * numInstances;
+            for (size_t k = 0; k < numInstances; k++)
+            {
+                double difference = column[i] - column[k];
+                distanceRow[k] += difference * difference;
+            }
+        }
+    }
+
+    // Takes one feature column's contribution back out of every pair
+    void removeFeature(const double *column)
+    {
+        for (size_t i = 0; i < numInstances; i++)
+        {
+            double *distanceRow = distances.data() + i * numInstances;
+            for (size_t k = 0; k < numInstances; k++)
+            {
+                double difference = column[i] - column[k];
+                distanceRow[k] -= difference * difference;
+            }
+        }
+    }
+};
+
+// Settings that change how Validator scores a subset
+struct EvaluationOptions
+{
+    bool earlyAbandon = false;    // Abandon training rows once they cannot be nearest
+    bool orderByVariance = false; // Sum high-variance features first so rows are abandoned sooner; may break near ties differently
+    bool spatialIndex = false;    // Answer low-dimensional subsets from a k-d tree
+    size_t spatialIndexMaxDims = 4; // Larger subsets fall back to brute force
+    bool blockedAllPairs = false; // Score leave-one-out as one tiled all-pairs problem
+    ApproximateOptions approximate; // Find neighbors from a random projection forest instead
+    ValuePrecision precision = ValuePrecision::Double; // Storage of the columns evaluate() scans
+    ValidationOptions validation; // How the accuracy of a subset is estimated
+};
+
+// Outcome of an evaluation that may stop early. When pruned is set the
+// evaluation was cut short and accuracy is only an upper bound, already
+// known to be below the target it was given.
+struct BoundedAccuracy
+{
+    double accuracy = 0.0;
+    bool pruned = false;
+};
+
+// How leave-one-out results over reduced-precision columns compare with
+// the same evaluation over doubles
+struct PrecisionReport
+{
+    size_t numInstances = 0;
+    size_t changedPredictions = 0; // Instances whose predicted label differs
+    double doubleAccuracy = 0.0;
+    double reducedAccuracy = 0.0;
+};
+
+// Leave-one-out accuracies of k-nearest-neighbor voting; entry k - 1 is
+// for k neighbors
+struct NeighborVotingAccuracies
+{
+    vector<double> majority;
+    vector<double> weighted; // Votes weighted by 1 / distance
+};
+
+// How approximate neighbors compare with exact ones on a sample of
+// leave-one-out predictions
+struct ApproximationReport
+{
+    size_t sampled = 0;
+    size_t nearestFound = 0; // Instances whose approximate neighbor is as near as the exact one
+    double approximateAccuracy = 0.0; // Over the sample
+    double exactAccuracy = 0.0;
+};
+
+// Counts misclassifications across the workers of one leave-one-out pass
+// and says when there are enough of them that the pass can no longer reach
+// its target accuracy. The bound is strict: a subset that could still tie
+// the target is always scored in full.
+class MissBudget
+{
+private:
+    size_t numInstances;
+    size_t maxMisses; // Most misses that still allow reaching the target
+    atomic<size_t> misses{0};
+
+public:
+    MissBudget(size_t numInstances, double targetAccuracy)
+        : numInstances(numInstances), maxMisses(numInstances)
+    {
+        // Found with the same floating-point comparison the search uses
+        while (maxMisses > 0 && static_cast<double>(numInstances - maxMisses) / numInstances < targetAccuracy)
+        {
+            maxMisses--;
+        }
+    }
+
+    void recordMiss()
+    {
+        misses.fetch_add(1, memory_order_relaxed);
+    }
+
+    bool exhausted() const
+    {
+        return misses.load(memory_order_relaxed) > maxMisses;
+    }
+
+    // Called once a pass has finished or given up
+    BoundedAccuracy result(size_t correctPredictions) const
+    {
+        NN_METRIC_COUNT("folds", correctPredictions + misses.load());
+        if (exhausted())
+        {
+            NN_METRIC_COUNT("evaluations_pruned", 1);
+            return {static_cast<double>(numInstances - misses.load()) / numInstances, true};
+        }
+        return {static_cast<double>(correctPredictions) / numInstances, false};
+    }
+};
+
+// The Validator class handles data preprocessing and evaluation
+class Validator
+{
+private:
+    const Dataset normalizedData; // Read-only, so a borrowed (mapped) dataset is never copied
+    vector<int> labels;
+    EvaluationOptions options;
+    vector<double> featureVariances; // Of the normalized columns
+    PairwiseDistanceMatrix distanceMatrix; // Distances over the committed subset
+    FeatureSubset matrixFeatures;          // The committed subset
+    ThreadPool &pool;
+    vector<NearestNeighborClassifier> classifiers; // One per pool worker
+    const ColumnStore *store = nullptr; // Set when the columns are streamed from disk
+    BasicDataset<float> float32Data;         // Reduced-precision copies of normalizedData,
+    BasicDataset<std::int16_t> int16Data;    // built for the selected precision only
+    size_t memoryBudget = 0;            // Bytes of blocks an out-of-core evaluation may hold
+    EvaluationCache *cache = nullptr;   // Results of subsets scored before, if set
+    uint64_t datasetChecksum = 0;       // Identifies this data among the cache's entries
+    vector<ValidationFold> validationFolds; // Empty for leave-one-out
+    mutable vector<PairwiseDistanceMatrix> grayCodeMatrices; // One per worker enumerating with a matrix
+
+    // Per-worker tally of correct predictions, padded so workers never
+    // write to the same cache line
+    struct alignas(64) WorkerCount
+    {
+        size_t correct = 0;
+    };
+    mutable vector<WorkerCount> workerCounts;
+
+    // Buffers each worker keeps from one evaluation to the next, so scoring
+    // a subset allocates nothing once they have grown to size
+    struct WorkerScratch
+    {
+        vector<double> query;                // A held-out instance over the subset
+        vector<double> approximateDistances; // A matrix row with one column added or taken away
+        vector<NeighborScreen> screens;      // The query rows of an all-pairs block
+    };
+    mutable vector<WorkerScratch> workerScratch;
+
+    // Held-out instances handed to a worker at a time
+    static constexpr size_t FoldChunkSize = 16;
+
+    // Query rows the blocked all-pairs screen takes at a time; each block
+    // streams every training row once, so blocks are much larger than a chunk
+    static constexpr size_t AllPairsBlockRows = 256;
+
+    // Runs countRange over the held-out instances on every worker and adds
+    // up the per-worker counts once they have all finished. When this is
+    // already running on a pool worker (several candidates being scored at
+    // once) the instances are counted on that worker alone. countRange
+    // records each misclassification in budget and stops once it is spent.
+    template <typename CountRange>
+    size_t countCorrectInParallel(size_t numInstances, MissBudget &budget, const CountRange &countRange,
+                                  size_t chunkSize = FoldChunkSize) const
+    {
+        if (pool.insideJob())
+        {
+            size_t correctPredictions = 0;
+            pool.parallelFor(numInstances, numInstances, [&](size_t begin, size_t end, size_t worker)
+                             { correctPredictions += countRange(begin, end, worker, budget); });
+            return correctPredictions;
+        }
+
+        for (WorkerCount &count : workerCounts)
+        {
+            count.correct = 0;
+        }
+        pool.parallelFor(numInstances, chunkSize, [&](size_t begin, size_t end, size_t worker)
+                         { workerCounts[worker].correct += countRange(begin, end, worker, budget); });
+
+        size_t correctPredictions = 0;
+        for (const WorkerCount &count : workerCounts)
+        {
+            correctPredictions += count.correct;
+        }
+        return correctPredictions;
+    }
+
+    // Normalized values lie in [0, 1], so accumulated rounding in the matrix
+    // stays many orders of magnitude below this
+    static constexpr double MatrixTolerance = 1e-9;
+
+    // 16384^2 doubles is 2 GiB; beyond that subsets are scored from scratch
+    static constexpr size_t MaxMatrixInstances = 16384;
+
+    // Gray-code steps between rebuilds of the enumeration's matrix
+    static constexpr uint64_t GrayCodeRebuildInterval = 1024;
+
+    // Squared distance between two instances, summed in subset order exactly
+    // as NearestNeighborClassifier::Test does it
+    double exactDistance(size_t a, size_t b, const vector<size_t> &featureSubset) const
+    {
+        double distance = 0.0;
+        for (size_t j : featureSubset)
+        {
+            const double *column = normalizedData.column(j);
+            double difference = column[a] - column[b];
+            distance += difference * difference;
+        }
+        return distance;
+    }
+
+    // Leave-one-out accuracy over the matrix with one column's contribution
+    // added (sign = 1) or taken away (sign = -1). Adding and subtracting
+    // columns rounds differently from summing a subset in order, which is
+    // enough to flip exact ties (duplicate rows are common in integer data).
+    // So the matrix only finds the neighbors within MatrixTolerance of the
+    // minimum, and those few are re-scored exactly over the candidate subset.
+    BoundedAccuracy evaluateAgainstMatrix(const double *column, double sign,
+                                          const vector<size_t> &candidateSubset, double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_matrix");
+        if (distanceMatrix.size() < 2)
+        {
+            throw runtime_error("Incremental search needs at least two instances");
+        }
+
+        size_t numInstances = distanceMatrix.size();
+        MissBudget budget(numInstances, targetAccuracy);
+        size_t correctPredictions = countCorrectInParallel(numInstances, budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            NN_PERF_SCOPE("evaluate_matrix", (end - begin) * numInstances);
+            return countCorrectAgainstMatrix(column, sign, candidateSubset, begin, end, worker, budget);
+        });
+        return budget.result(correctPredictions);
+    }
+
+    // Label of the exact nearest neighbor of instance i over candidateSubset,
+    // looked for only among the instances whose approximate distance is
+    // within MatrixTolerance of approximateMin, the smallest of them
+    int nearestLabelWithin(size_t i, const double *approximate, double approximateMin,
+                           const vector<size_t> &candidateSubset) const
+    {
+        thread_local vector<size_t> nearCandidates;
+        CollectWithin(approximate, labels.size(), approximateMin + MatrixTolerance, nearCandidates);
+        double minDistance = numeric_limits<double>::max();
+        int nearestLabel = labels[i == 0 ? 1 : 0];
+        for (size_t k : nearCandidates)
+        {
+            if (k == i)
+            {
+                continue;
+            }
+
+            double distance = exactDistance(i, k, candidateSubset);
+            if (distance < minDistance)
+            {
+                minDistance = distance;
+                nearestLabel = labels[k];
+            }
+        }
+        return nearestLabel;
+    }
+
+    // Adds one column's contribution to matrix (sign = 1) or takes it away
+    // (sign = -1) and, in the same pass over the matrix, counts the
+    // instances leave-one-out then classifies correctly over subset, the
+    // features the matrix holds afterwards
+    size_t applyAndCountCorrect(PairwiseDistanceMatrix &matrix, const double *column, double sign,
+                                const vector<size_t> &subset) const
+    {
+        size_t correctPredictions = 0;
+        size_t numInstances = matrix.size();
+        for (size_t i = 0; i < numInstances; i++)
+        {
+            double *distanceRow = matrix.row(i);
+            double approximateMin = AccumulateRow(distanceRow, column, i, sign, numInstances);
+            correctPredictions += nearestLabelWithin(i, distanceRow, approximateMin, subset) == labels[i];
+        }
+        return correctPredictions;
+    }
+
+    // Held-out instances in [begin, end) that evaluateAgainstMatrix classifies correctly
+    size_t countCorrectAgainstMatrix(const double *column, double sign, const vector<size_t> &candidateSubset,
+                                     size_t begin, size_t end, size_t worker, MissBudget &budget) const
+    {
+        size_t correctPredictions = 0;
+        size_t numInstances = distanceMatrix.size();
+        vector<double> &approximateDistances = workerScratch[worker].approximateDistances;
+        approximateDistances.resize(numInstances);
+
+        for (size_t i = begin; i < end && !budget.exhausted(); i++)
+        {
+            const double *distanceRow = distanceMatrix.row(i);
+            double approximateMin = numeric_limits<double>::max();
+
+            for (size_t k = 0; k < numInstances; k++)
+            {
+                double difference = column[i] - column[k];
+                approximateDistances[k] = distanceRow[k] + sign * difference * difference;
+                if (k != i && approximateDistances[k] < approximateMin)
+                {
+                    approximateMin = approximateDistances[k];
+                }
+            }
+
+            if (nearestLabelWithin(i, approximateDistances.data(), approximateMin, candidateSubset) == labels[i])
+            {
+                correctPredictions++;
+            }
+            else
+            {
+                budget.recordMiss();
+            }
+        }
+
+        return correctPredictions;
+    }
+
+    // Label predicted for instance i by its nearest other row in table
+    template <typename T>
+    int predictLeaveOneOut(const BasicDataset<T> &table, const vector<size_t> &featureSubset, size_t i,
+                           vector<double> &query) const
+    {
+        for (size_t j = 0; j < featureSubset.size(); j++)
+        {
+            query[j] = static_cast<double>(table.column(featureSubset[j])[i]);
+        }
+        BasicColumnSelection<T> selection = {&table, featureSubset.data(), featureSubset.size()};
+        NeighborMatch nearest = FindNearest(selection, query.data(), i);
+        if (nearest.index == NeighborMatch::NoNeighbor)
+        {
+            return labels[i == 0 ? 1 : 0];
+        }
+        return labels[nearest.index];
+    }
+
+    // Leave-one-out accuracy over a reduced-precision copy of the columns
+    template <typename T>
+    BoundedAccuracy evaluateReduced(const BasicDataset<T> &table, const vector<size_t> &featureSubset,
+                                    double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_reduced");
+        size_t numInstances = table.getNumInstances();
+        MissBudget budget(numInstances, targetAccuracy);
+        size_t correctPredictions = countCorrectInParallel(numInstances, budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            NN_PERF_SCOPE("evaluate_reduced", (end - begin) * numInstances);
+            vector<double> &query = workerScratch[worker].query;
+            query.resize(featureSubset.size());
+            size_t correct = 0;
+            for (size_t i = begin; i < end && !budget.exhausted(); i++)
+            {
+                if (predictLeaveOneOut(table, featureSubset, i, query) == labels[i])
+                {
+                    correct++;
+                }
+                else
+                {
+                    budget.recordMiss();
+                }
+            }
+            return correct;
+        });
+        return budget.result(correctPredictions);
+    }
+
+    // Leave-one-out accuracy from the blocked all-pairs screen (see
+    // BlockedNeighbors.h): each worker screens a block of query rows against
+    // every row, then re-scores the few candidates of each exactly, so the
+    // predictions are the scan's. Needs a nonempty subset; with no features
+    // every row would be a candidate.
+    BoundedAccuracy evaluateAllPairs(const vector<size_t> &featureSubset, double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_all_pairs");
+        size_t numInstances = normalizedData.getNumInstances();
+        vector<const double *> columns;
+        for (size_t j : featureSubset)
+        {
+            columns.push_back(normalizedData.column(j));
+        }
+        vector<double> norms = SquaredNorms(columns.data(), columns.size(), numInstances);
+        double maxNorm = *max_element(norms.begin(), norms.end());
+        ScreenColumns data = {columns.data(), columns.size(), norms.data(), numInstances};
+
+        MissBudget budget(numInstances, targetAccuracy);
+        size_t correctPredictions = countCorrectInParallel(numInstances, budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            if (budget.exhausted())
+            {
+                return size_t(0);
+            }
+            NN_PERF_SCOPE("evaluate_all_pairs", (end - begin) * numInstances);
+            vector<NeighborScreen> &screens = workerScratch[worker].screens;
+            screens.resize(end - begin);
+            for (size_t i = begin; i < end; i++)
+            {
+                NeighborScreen &screen = screens[i - begin];
+                screen.minimum = numeric_limits<double>::max();
+                screen.tolerance = ScreenTolerance(featureSubset.size(), norms[i], maxNorm);
+                screen.candidates.clear();
+            }
+            ScreenNeighbors(data, begin, end, screens.data());
+
+            size_t correct = 0;
+            for (size_t i = begin; i < end && !budget.exhausted(); i++)
+            {
+                double minDistance = numeric_limits<double>::max();
+                int nearestLabel = labels[i == 0 ? 1 : 0];
+                for (const pair<double, size_t> &candidate : screens[i - begin].candidates)
+                {
+                    double distance = exactDistance(i, candidate.second, featureSubset);
+                    if (distance < minDistance)
+                    {
+                        minDistance = distance;
+                        nearestLabel = labels[candidate.second];
+                    }
+                }
+                if (nearestLabel == labels[i])
+                {
+                    correct++;
+                }
+                else
+                {
+                    budget.recordMiss();
+                }
+            }
+            return correct;
+        }, AllPairsBlockRows);
+        return budget.result(correctPredictions);
+    }
+
+    // Label the projection forest predicts for instance i, which it skips
+    int predictApproximate(const ProjectionForest &forest, const vector<size_t> &featureSubset, size_t i,
+                           vector<double> &query) const
+    {
+        for (size_t j = 0; j < featureSubset.size(); j++)
+        {
+            query[j] = normalizedData.column(featureSubset[j])[i];
+        }
+        NeighborMatch nearest = forest.findNearest(query.data(), i);
+        if (nearest.index == NeighborMatch::NoNeighbor)
+        {
+            return labels[i == 0 ? 1 : 0];
+        }
+        return labels[nearest.index];
+    }
+
+    // Leave-one-out accuracy with every neighbor looked up in a projection
+    // forest over the subset, built once here and shared by the workers
+    BoundedAccuracy evaluateApproximate(const vector<size_t> &featureSubset, double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_approximate");
+        size_t numInstances = normalizedData.getNumInstances();
+        ProjectionForest forest(ColumnSelection{&normalizedData, featureSubset.data(), featureSubset.size()},
+                                options.approximate, pool);
+        MissBudget budget(numInstances, targetAccuracy);
+        size_t correctPredictions = countCorrectInParallel(numInstances, budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            NN_PERF_SCOPE("evaluate_approximate", (end - begin) * options.approximate.numTrees * options.approximate.leafSize);
+            vector<double> &query = workerScratch[worker].query;
+            query.resize(featureSubset.size());
+            size_t correct = 0;
+            for (size_t i = begin; i < end && !budget.exhausted(); i++)
+            {
+                if (predictApproximate(forest, featureSubset, i, query) == labels[i])
+                {
+                    correct++;
+                }
+                else
+                {
+                    budget.recordMiss();
+                }
+            }
+            return correct;
+        });
+        return budget.result(correctPredictions);
+    }
+
+    // Copies the rows listed of the featureSubset columns of table, in order
+    template <typename T>
+    static BasicDataset<T> gatherRows(const BasicDataset<T> &table, const vector<size_t> &rows,
+                                      const vector<size_t> &featureSubset)
+    {
+        BasicDataset<T> gathered(rows.size(), featureSubset.size());
+        for (size_t j = 0; j < featureSubset.size(); j++)
+        {
+            const T *source = table.column(featureSubset[j]);
+            T *destination = gathered.column(j);
+            for (size_t r = 0; r < rows.size(); r++)
+            {
+                destination[r] = source[rows[r]];
+            }
+        }
+        return gathered;
+    }
+
+    // Accuracy over the k-fold or holdout rounds: every testing instance of
+    // a round is classified against that round's training rows, and the
+    // accuracy is the share of all those predictions that were right
+    template <typename T>
+    BoundedAccuracy evaluateFolds(const BasicDataset<T> &table, const vector<size_t> &featureSubset,
+                                  double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_folds");
+        size_t numPredictions = 0;
+        for (const ValidationFold &fold : validationFolds)
+        {
+            numPredictions += fold.testing.size();
+        }
+
+        MissBudget budget(numPredictions, targetAccuracy);
+        size_t correctPredictions = 0;
+        for (const ValidationFold &fold : validationFolds)
+        {
+            if (budget.exhausted())
+            {
+                break;
+            }
+            BasicDataset<T> training = gatherRows(table, fold.training, featureSubset);
+            BasicColumnSelection<T> selection = {&training, nullptr, featureSubset.size()};
+            correctPredictions += countCorrectInParallel(fold.testing.size(), budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+            {
+                NN_PERF_SCOPE("evaluate_folds", (end - begin) * fold.training.size());
+                vector<double> &query = workerScratch[worker].query;
+                query.resize(featureSubset.size());
+                size_t correct = 0;
+                for (size_t t = begin; t < end && !budget.exhausted(); t++)
+                {
+                    size_t i = fold.testing[t];
+                    for (size_t j = 0; j < featureSubset.size(); j++)
+                    {
+                        query[j] = static_cast<double>(table.column(featureSubset[j])[i]);
+                    }
+                    NeighborMatch nearest = FindNearest(selection, query.data());
+                    if (labels[fold.training[nearest.index]] == labels[i])
+                    {
+                        correct++;
+                    }
+                    else
+                    {
+                        budget.recordMiss();
+                    }
+                }
+                return correct;
+            });
+        }
+        return budget.result(correctPredictions);
+    }
+
+    // Of the listed instances, how many leave-one-out classifies correctly
+    // from the rest of table
+    template <typename T>
+    size_t countCorrectAt(const BasicDataset<T> &table, const vector<size_t> &featureSubset,
+                          const vector<size_t> &instances) const
+    {
+        NN_METRIC_COUNT("folds", instances.size());
+        MissBudget budget(instances.size(), NoTarget);
+        return countCorrectInParallel(instances.size(), budget, [&](size_t begin, size_t end, size_t worker, MissBudget &)
+        {
+            NN_PERF_SCOPE("evaluate_race", (end - begin) * table.getNumInstances());
+            vector<double> &query = workerScratch[worker].query;
+            query.resize(featureSubset.size());
+            size_t correct = 0;
+            for (size_t t = begin; t < end; t++)
+            {
+                correct += predictLeaveOneOut(table, featureSubset, instances[t], query) == labels[instances[t]];
+            }
+            return correct;
+        });
+    }
+
+    // Runs leave-one-out over doubles and over table side by side
+    template <typename T>
+    PrecisionReport comparePredictions(const BasicDataset<T> &table, const vector<size_t> &featureSubset) const
+    {
+        size_t numInstances = normalizedData.getNumInstances();
+        atomic<size_t> changed{0};
+        atomic<size_t> doubleCorrect{0};
+        atomic<size_t> reducedCorrect{0};
+        pool.parallelFor(numInstances, FoldChunkSize, [&](size_t begin, size_t end, size_t worker)
+                         {
+                             vector<double> &query = workerScratch[worker].query;
+                             query.resize(featureSubset.size());
+                             size_t localChanged = 0, localDouble = 0, localReduced = 0;
+                             for (size_t i = begin; i < end; i++)
+                             {
+                                 int exact = predictLeaveOneOut(normalizedData, featureSubset, i, query);
+                                 int reduced = predictLeaveOneOut(table, featureSubset, i, query);
+                                 localChanged += exact != reduced;
+                                 localDouble += exact == labels[i];
+                                 localReduced += reduced == labels[i];
+                             }
+                             changed += localChanged;
+                             doubleCorrect += localDouble;
+                             reducedCorrect += localReduced;
+                         });
+
+        PrecisionReport report;
+        report.numInstances = numInstances;
+        report.changedPredictions = changed;
+        report.doubleAccuracy = static_cast<double>(doubleCorrect) / numInstances;
+        report.reducedAccuracy = static_cast<double>(reducedCorrect) / numInstances;
+        return report;
+    }
+
+    // Checksum of the labels and normalized columns. An in-memory dataset and
+    // its column store have the same one, so they share cached results.
+    uint64_t contentChecksum() const
+    {
+        SourceChecksum checksum;
+        checksum.update(reinterpret_cast<const char *>(labels.data()), labels.size() * sizeof(int));
+        size_t numInstances = getNumInstances();
+        size_t blockRows = max<size_t>(memoryBudget / sizeof(double), Dataset::ValuesPerCacheLine);
+        for (size_t j = 0; j < getNumFeatures(); j++)
+        {
+            if (store == nullptr)
+            {
+                checksum.update(reinterpret_cast<const char *>(normalizedData.column(j)), numInstances * sizeof(double));
+                continue;
+            }
+            for (size_t begin = 0; begin < numInstances; begin += blockRows)
+            {
+                size_t count = min(blockRows, numInstances - begin);
+                Dataset block = store->readBlock(&j, 1, begin, count);
+                checksum.update(reinterpret_cast<const char *>(block.column(0)), count * sizeof(double));
+            }
+        }
+        return checksum.value();
+    }
+
+    // Settings that can change an accuracy. Early abandoning, the k-d tree,
+    // the distance matrix, the all-pairs screen and out-of-core streaming all
+    // reproduce the plain scan exactly, so they are left out. Variance
+    // ordering sums the same squares in another order, which can round two
+    // nearly tied rows the other way round, so it is kept. For exact
+    // leave-one-out in subset order this is the precision alone, as before
+    // validation strategies existed, so caches written then stay valid.
+    uint64_t resultSettings() const
+    {
+        uint64_t settings = static_cast<uint64_t>(options.precision);
+        auto mix = [&](uint64_t field)
+        {
+            settings = (settings ^ field) * 1099511628211ull;
+            settings ^= settings >> 29;
+        };
+        const ValidationOptions &validation = options.validation;
+        if (validation.strategy != ValidationStrategy::LeaveOneOut)
+        {
+            uint64_t fraction;
+            memcpy(&fraction, &validation.holdoutFraction, sizeof(fraction));
+            for (uint64_t field : {static_cast<uint64_t>(validation.strategy), uint64_t(validation.folds),
+                                   uint64_t(validation.repetitions), fraction, validation.seed})
+            {
+                mix(field);
+            }
+        }
+        const ApproximateOptions &approximate = options.approximate;
+        if (approximate.enabled)
+        {
+            // Tagged so it never matches a validation strategy's fields
+            for (uint64_t field : {uint64_t(0x415050524f58ull), uint64_t(approximate.numTrees),
+                                   uint64_t(approximate.leafSize), approximate.seed})
+            {
+                mix(field);
+            }
+        }
+        if (options.orderByVariance)
+        {
+            mix(uint64_t(0x5641524f52444552ull)); // Tagged like the approximate fields
+        }
+        return settings;
+    }
+
+    // Answers featureSubset from the cache when it can, otherwise runs
+    // evaluate() and records what it found
+    template <typename Evaluate>
+    BoundedAccuracy memoized(const FeatureSubset &featureSubset, double targetAccuracy, const Evaluate &evaluate) const
+    {
+        if (cache == nullptr)
+        {
+            return evaluate();
+        }
+        EvaluationCache::Key key = {datasetChecksum, resultSettings(), featureSubset};
+        EvaluationCache::Entry entry;
+        if (cache->lookup(key, targetAccuracy, entry))
+        {
+            NN_METRIC_COUNT("evaluation_cache_hits", 1);
+            return {entry.accuracy, !entry.exact};
+        }
+        BoundedAccuracy result = evaluate();
+        cache->record(key, {result.accuracy, !result.pruned});
+        return result;
+    }
+
+    // Leave-one-out accuracy with the columns streamed from the store. The
+    // held-out instances are taken a block at a time; for each block every
+    // block of training rows is read in turn and scanned with the same
+    // kernel as the in-memory path, keeping each instance's nearest
+    // neighbor so far. Blocks are visited in row order and a later block
+    // only wins on a strictly smaller distance, so ties still go to the
+    // lowest index and the result matches the in-memory evaluation.
+    BoundedAccuracy evaluateOutOfCore(const vector<size_t> &featureSubset, double targetAccuracy) const
+    {
+        NN_METRIC_TIMER("evaluate_out_of_core");
+        size_t numInstances = store->getNumInstances();
+        if (numInstances < 2)
+        {
+            throw runtime_error("Leave-one-out validation needs at least two instances");
+        }
+
+        // Candidates scored at the same time share the budget. A query block
+        // and a training block each get half of it.
+        size_t budget = pool.insideJob() ? memoryBudget / pool.size() : memoryBudget;
+        size_t rowBytes = featureSubset.size() * sizeof(double) + sizeof(NeighborMatch);
+        size_t blockRows = max<size_t>(budget / 2 / rowBytes, Dataset::ValuesPerCacheLine);
+
+        MissBudget misses(numInstances, targetAccuracy);
+        size_t correctPredictions = 0;
+        vector<NeighborMatch> nearest;
+        for (size_t queryBegin = 0; queryBegin < numInstances && !misses.exhausted(); queryBegin += blockRows)
+        {
+            size_t queryCount = min(blockRows, numInstances - queryBegin);
+            Dataset queries = store->readBlock(featureSubset.data(), featureSubset.size(), queryBegin, queryCount);
+            nearest.assign(queryCount, NeighborMatch());
+
+            for (size_t trainingBegin = 0; trainingBegin < numInstances; trainingBegin += blockRows)
+            {
+                size_t trainingCount = min(blockRows, numInstances - trainingBegin);
+                Dataset training;
+                if (trainingBegin != queryBegin)
+                {
+                    training = store->readBlock(featureSubset.data(), featureSubset.size(), trainingBegin, trainingCount);
+                }
+                ColumnSelection selection = {trainingBegin == queryBegin ? &queries : &training, nullptr, featureSubset.size()};
+
+                pool.parallelFor(queryCount, FoldChunkSize, [&](size_t begin, size_t end, size_t worker)
+                                 {
+                                     NN_PERF_SCOPE("evaluate_out_of_core", (end - begin) * trainingCount);
+                                     vector<double> &query = workerScratch[worker].query;
+                                     query.resize(featureSubset.size());
+                                     for (size_t q = begin; q < end; q++)
+                                     {
+                                         for (size_t j = 0; j < featureSubset.size(); j++)
+                                         {
+                                             query[j] = queries.column(j)[q];
+                                         }
+                                         size_t instance = queryBegin + q;
+                                         bool inBlock = instance >= trainingBegin && instance < trainingBegin + trainingCount;
+                                         NeighborMatch match = FindNearest(selection, query.data(),
+                                                                           inBlock ? instance - trainingBegin : NeighborMatch::NoNeighbor);
+                                         if (match.index != NeighborMatch::NoNeighbor && match.distance < nearest[q].distance)
+                                         {
+                                             nearest[q].distance = match.distance;
+                                             nearest[q].index = trainingBegin + match.index;
+                                         }
+                                     }
+                                 });
+            }
+
+            for (size_t q = 0; q < queryCount; q++)
+            {
+                size_t instance = queryBegin + q;
+                size_t neighbor = nearest[q].index;
+                int predictedLabel = neighbor == NeighborMatch::NoNeighbor ? labels[instance == 0 ? 1 : 0] : labels[neighbor];
+                if (predictedLabel == labels[instance])
+                {
+                    correctPredictions++;
+                }
+                else
+                {
+                    misses.recordMiss();
+                }
+            }
+        }
+        return misses.result(correctPredictions);
+    }
+
+    // Subsets are FeatureSubset bitsets, which bound the number of features
+    static void checkFeatureCount(size_t numFeatures)
+    {
+        if (numFeatures > FeatureSubset::Capacity)
+        {
+            throw runtime_error("Datasets with more than " + to_string(FeatureSubset::Capacity) +
+                                " features are not supported");
+        }
+    }
+
+    // Prevent implicit copying
+    Validator(const Validator &) = delete;
+    Validator &operator=(const Validator &) = delete;
+
+public:
+    // Target accuracy that never prunes
+    static constexpr double NoTarget = -1.0;
+
+    Validator(const Dataset &data, const vector<int> &labels, ThreadPool &pool,
+              const EvaluationOptions &options = EvaluationOptions())
+        : Validator(PreparedDataset{normalizeData(data), labels, {}, {}}, pool, options)
+    {
+    }
+
+    // Takes features that are already normalized, e.g. from a dataset cache
+    Validator(const PreparedDataset &prepared, ThreadPool &pool,
+              const EvaluationOptions &options = EvaluationOptions())
+        : normalizedData(prepared.features), labels(prepared.labels), options(options), pool(pool),
+          classifiers(pool.size()), workerCounts(pool.size()), workerScratch(pool.size())
+    {
+        checkFeatureCount(normalizedData.getNumColumns());
+        validationFolds = BuildValidationFolds(labels, options.validation);
+        if (options.approximate.enabled &&
+            (options.precision != ValuePrecision::Double || !validationFolds.empty() || options.approximate.numTrees == 0))
+        {
+            throw runtime_error("Approximate neighbors need at least one tree, double precision and leave-one-out validation");
+        }
+        for (NearestNeighborClassifier &classifier : classifiers)
+        {
+            classifier.SetEarlyAbandon(options.earlyAbandon);
+        }
+
+        if (options.precision == ValuePrecision::Float32)
+        {
+            float32Data = ToFloat32(normalizedData);
+        }
+        else if (options.precision == ValuePrecision::Int16)
+        {
+            int16Data = ToInt16(normalizedData);
+        }
+
+        for (size_t j = 0; j < normalizedData.getNumColumns(); j++)
+        {
+            const double *column = normalizedData.column(j);
+            size_t numInstances = normalizedData.getNumInstances();
+            double mean = 0.0;
+            for (size_t i = 0; i < numInstances; i++)
+            {
+                mean += column[i];
+            }
+            mean /= numInstances;
+
+            double variance = 0.0;
+            for (size_t i = 0; i < numInstances; i++)
+            {
+                variance += (column[i] - mean) * (column[i] - mean);
+            }
+            featureVariances.push_back(variance / numInstances);
+        }
+    }
+
+    // Streams the normalized columns from store instead of holding them,
+    // reading blocks of at most memoryBudget bytes in total. The distance
+    // matrix, k-d tree and early abandoning are not used in this mode.
+    Validator(const ColumnStore &store, size_t memoryBudget, ThreadPool &pool,
+              const EvaluationOptions &options = EvaluationOptions())
+        : labels(store.readLabels()), options(options), pool(pool), store(&store), memoryBudget(memoryBudget),
+          workerScratch(pool.size())
+    {
+        checkFeatureCount(store.getNumColumns());
+        if (options.validation.strategy != ValidationStrategy::LeaveOneOut)
+        {
+            throw runtime_error("Only leave-one-out validation can stream the dataset from disk");
+        }
+        if (options.approximate.enabled)
+        {
+            throw runtime_error("Approximate neighbors need the dataset in memory");
+        }
+    }
+
+    static Dataset normalizeData(const Dataset &data)
+    {
+        return NormalizeColumns(data);
+    }
+
+    double evaluate(const FeatureSubset &featureSubset)
+    {
+        return evaluateBounded(featureSubset, NoTarget).accuracy;
+    }
+
+    // Like evaluate, but gives up as soon as the subset has misclassified too
+    // many instances to reach targetAccuracy and reports it as pruned
+    BoundedAccuracy evaluateBounded(const FeatureSubset &featureSubset, double targetAccuracy)
+    {
+        NN_METRIC_TIMER("evaluate");
+        return memoized(featureSubset, targetAccuracy, [&]()
+                        { return scanBounded(featureSubset.indices(), targetAccuracy); });
+    }
+
+    // Scores the features listed, in that order, from the columns,
+    // bypassing the cache
+    BoundedAccuracy scanBounded(const vector<size_t> &featureSubset, double targetAccuracy)
+    {
+        NN_METRIC_TIMER("evaluate_scan");
+        if (store != nullptr)
+        {
+            return evaluateOutOfCore(featureSubset, targetAccuracy);
+        }
+        if (!validationFolds.empty())
+        {
+            if (options.precision == ValuePrecision::Float32)
+            {
+                return evaluateFolds(float32Data, featureSubset, targetAccuracy);
+            }
+            if (options.precision == ValuePrecision::Int16)
+            {
+                return evaluateFolds(int16Data, featureSubset, targetAccuracy);
+            }
+            return evaluateFolds(normalizedData, featureSubset, targetAccuracy);
+        }
+        if (options.precision == ValuePrecision::Float32)
+        {
+            return evaluateReduced(float32Data, featureSubset, targetAccuracy);
+        }
+        if (options.precision == ValuePrecision::Int16)
+        {
+            return evaluateReduced(int16Data, featureSubset, targetAccuracy);
+        }
+        size_t numInstances = normalizedData.getNumInstances();
+        if (options.approximate.enabled && numInstances >= 2)
+        {
+            return evaluateApproximate(featureSubset, targetAccuracy);
+        }
+        if (options.blockedAllPairs && !featureSubset.empty() && numInstances >= 2)
+        {
+            return evaluateAllPairs(featureSubset, targetAccuracy);
+        }
+
+        // Widely spread features make the largest contributions, so summing
+        // them first lets early abandoning reject rows after fewer terms
+        vector<size_t> orderedSubset;
+        if (options.orderByVariance)
+        {
+            orderedSubset = featureSubset;
+            stable_sort(orderedSubset.begin(), orderedSubset.end(), [&](size_t a, size_t b)
+                        { return featureVariances[a] > featureVariances[b]; });
+        }
+        const vector<size_t> &scanOrder = options.orderByVariance ? orderedSubset : featureSubset;
+
+        // Small subsets are answered from a k-d tree, built once here and
+        // shared read-only by every worker
+        unique_ptr<KdTree> index;
+        if (options.spatialIndex && !scanOrder.empty() && scanOrder.size() <= options.spatialIndexMaxDims)
+        {
+            index = make_unique<KdTree>(ColumnSelection{&normalizedData, scanOrder.data(), scanOrder.size()});
+        }
+
+        // Perform leave-one-out cross validation; each worker's classifier
+        // reads the normalized rows in place and skips the held-out one
+        MissBudget budget(numInstances, targetAccuracy);
+        auto countRange = [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            NearestNeighborClassifier &classifier = classifiers[worker];
+            classifier.TrainView(normalizedData, labels, scanOrder, index.get());
+            size_t correct = 0;
+            for (size_t i = begin; i < end && !budget.exhausted(); i++)
+            {
+                if (classifier.TestLeaveOneOut(i) == labels[i])
+                {
+                    correct++;
+                }
+                else
+                {
+                    budget.recordMiss();
+                }
+            }
+            return correct;
+        };
+        size_t correctPredictions = countCorrectInParallel(numInstances, budget, [&](size_t begin, size_t end, size_t worker, MissBudget &budget)
+        {
+            // The tree computes distances to a few leaves only and does not
+            // count them, so its phase records none
+            if (index)
+            {
+                NN_PERF_SCOPE("evaluate_kd_tree", 0);
+                return countRange(begin, end, worker, budget);
+            }
+            NN_PERF_SCOPE("evaluate_scan", (end - begin) * numInstances);
+            return countRange(begin, end, worker, budget);
+        });
+
+        return budget.result(correctPredictions);
+    }
+
+    // Keeps every result from now on in cache and answers subsets it
+    // already holds for this data without scanning
+    void useCache(EvaluationCache &cache)
+    {
+        datasetChecksum = contentChecksum();
+        this->cache = &cache;
+    }
+
+    // Whether the N x N distance matrix behind the incremental and
+    // decremental searches fits in memory (8 bytes per pair of instances).
+    // The matrix holds exact double distances summed in subset order and
+    // serves leave-one-out, so reduced precision, variance ordering,
+    // approximate neighbors and the other validation strategies score every
+    // subset through evaluate() instead, whichever search asks.
+    bool supportsDistanceMatrix() const
+    {
+        return store == nullptr && options.precision == ValuePrecision::Double && validationFolds.empty() &&
+               !options.orderByVariance && !options.approximate.enabled &&
+               normalizedData.getNumInstances() <= MaxMatrixInstances;
+    }
+
+    // Racing samples exact leave-one-out folds of the in-memory columns
+    bool supportsRacing() const
+    {
+        return store == nullptr && validationFolds.empty() && !options.approximate.enabled;
+    }
+
+    // How many of the listed instances leave-one-out classifies correctly
+    // over featureSubset, at the selected precision; a race scores each
+    // candidate on a growing sample of instances this way. Bypasses the
+    // cache, which only holds full evaluations.
+    size_t countCorrectOn(const FeatureSubset &featureSubset, const vector<size_t> &instances) const
+    {
+        if (!supportsRacing())
+        {
+            throw runtime_error("Racing needs exact leave-one-out validation over an in-memory dataset");
+        }
+        vector<size_t> features = featureSubset.indices();
+        switch (options.precision)
+        {
+        case ValuePrecision::Float32:
+            return countCorrectAt(float32Data, features, instances);
+        case ValuePrecision::Int16:
+            return countCorrectAt(int16Data, features, instances);
+        default:
+            return countCorrectAt(normalizedData, features, instances);
+        }
+    }
+
+    // How many leave-one-out predictions for featureSubset change when the
+    // columns are read at the selected precision instead of as doubles
+    PrecisionReport comparePrecision(const FeatureSubset &featureSubset) const
+    {
+        vector<size_t> features = featureSubset.indices();
+        switch (options.precision)
+        {
+        case ValuePrecision::Float32:
+            return comparePredictions(float32Data, features);
+        case ValuePrecision::Int16:
+            return comparePredictions(int16Data, features);
+        default:
+            return comparePredictions(normalizedData, features);
+        }
+    }
+
+    // Leave-one-out accuracies of k-NN over featureSubset for every k from 1
+    // to maxK, with majority and with distance-weighted votes, from a single
+    // pass that keeps each held-out instance's maxK nearest neighbors (see
+    // FindNearestK). Accuracies for k = 1 are evaluate()'s. Reads the double
+    // columns in memory.
+    NeighborVotingAccuracies evaluateForEachK(const FeatureSubset &featureSubset, size_t maxK) const
+    {
+        NN_METRIC_TIMER("evaluate_knn");
+        size_t numInstances = getNumInstances();
+        if (store != nullptr || !validationFolds.empty())
+        {
+            throw runtime_error("k-NN evaluation needs leave-one-out validation over an in-memory dataset");
+        }
+        if (maxK == 0 || maxK >= numInstances)
+        {
+            throw runtime_error("k-NN needs k between 1 and " + to_string(numInstances - 1));
+        }
+
+        // Dense class ids, so votes are counted in small arrays
+        vector<int> classLabels = labels;
+        sort(classLabels.begin(), classLabels.end());
+        classLabels.erase(unique(classLabels.begin(), classLabels.end()), classLabels.end());
+        vector<size_t> classOf(numInstances);
+        for (size_t i = 0; i < numInstances; i++)
+        {
+            classOf[i] = lower_bound(classLabels.begin(), classLabels.end(), labels[i]) - classLabels.begin();
+        }
+
+        vector<size_t> features = featureSubset.indices();
+        ColumnSelection selection = {&normalizedData, features.data(), features.size()};
+        vector<size_t> majorityCorrect(maxK, 0);
+        vector<size_t> weightedCorrect(maxK, 0);
+        mutex countsMutex;
+        pool.parallelFor(numInstances, FoldChunkSize, [&](size_t begin, size_t end, size_t worker)
+                         {
+                             NN_PERF_SCOPE("evaluate_knn", (end - begin) * numInstances);
+                             vector<double> &query = workerScratch[worker].query;
+                             query.resize(features.size());
+                             vector<NeighborMatch> neighbors;
+                             NeighborVotes majority(classLabels.size(), false);
+                             NeighborVotes weighted(classLabels.size(), true);
+                             vector<size_t> localMajority(maxK, 0), localWeighted(maxK, 0);
+                             for (size_t i = begin; i < end; i++)
+                             {
+                                 for (size_t j = 0; j < features.size(); j++)
+                                 {
+                                     query[j] = normalizedData.column(features[j])[i];
+                                 }
+                                 FindNearestK(selection, query.data(), i, maxK, neighbors);
+                                 majority.clear();
+                                 weighted.clear();
+                                 for (size_t k = 0; k < neighbors.size(); k++)
+                                 {
+                                     size_t classId = classOf[neighbors[k].index];
+                                     majority.add(classId, neighbors[k].distance);
+                                     weighted.add(classId, neighbors[k].distance);
+                                     localMajority[k] += majority.winner() == classOf[i];
+                                     localWeighted[k] += weighted.winner() == classOf[i];
+                                 }
+                             }
+                             lock_guard<mutex> lock(countsMutex);
+                             for (size_t k = 0; k < maxK; k++)
+                             {
+                                 majorityCorrect[k] += localMajority[k];
+                                 weightedCorrect[k] += localWeighted[k];
+                             }
+                         });
+        NN_METRIC_COUNT("folds", numInstances);
+
+        NeighborVotingAccuracies accuracies;
+        for (size_t k = 0; k < maxK; k++)
+        {
+            accuracies.majority.push_back(static_cast<double>(majorityCorrect[k]) / numInstances);
+            accuracies.weighted.push_back(static_cast<double>(weightedCorrect[k]) / numInstances);
+        }
+        return accuracies;
+    }
+
+    // Compares the projection forest's leave-one-out predictions for
+    // featureSubset with exact ones on a random sample of instances
+    ApproximationReport calibrateApproximate(const FeatureSubset &featureSubset) const
+    {
+        vector<size_t> features = featureSubset.indices();
+        size_t numInstances = normalizedData.getNumInstances();
+        vector<size_t> sample(numInstances);
+        for (size_t i = 0; i < numInstances; i++)
+        {
+            sample[i] = i;
+        }
+        mt19937_64 random(options.approximate.seed);
+        shuffle(sample.begin(), sample.end(), random);
+        sample.resize(min(options.approximate.calibrationSample, numInstances));
+
+        ProjectionForest forest(ColumnSelection{&normalizedData, features.data(), features.size()},
+                                options.approximate, pool);
+        ColumnSelection selection = {&normalizedData, features.data(), features.size()};
+        atomic<size_t> nearestFound{0};
+        atomic<size_t> approximateCorrect{0};
+        atomic<size_t> exactCorrect{0};
+        pool.parallelFor(sample.size(), FoldChunkSize, [&](size_t begin, size_t end, size_t worker)
+                         {
+                             vector<double> &query = workerScratch[worker].query;
+                             query.resize(features.size());
+                             size_t localFound = 0, localApproximate = 0, localExact = 0;
+                             for (size_t s = begin; s < end; s++)
+                             {
+                                 size_t i = sample[s];
+                                 for (size_t j = 0; j < features.size(); j++)
+                                 {
+                                     query[j] = normalizedData.column(features[j])[i];
+                                 }
+                                 NeighborMatch approximate = forest.findNearest(query.data(), i);
+                                 NeighborMatch exact = FindNearest(selection, query.data(), i);
+                                 localFound += approximate.distance == exact.distance;
+                                 auto labelOf = [&](const NeighborMatch &match)
+                                 { return labels[match.index == NeighborMatch::NoNeighbor ? (i == 0 ? 1 : 0) : match.index]; };
+                                 localApproximate += labelOf(approximate) == labels[i];
+                                 localExact += labelOf(exact) == labels[i];
+                             }
+                             nearestFound += localFound;
+                             approximateCorrect += localApproximate;
+                             exactCorrect += localExact;
+                         });
+
+        ApproximationReport report;
+        report.sampled = sample.size();
+        report.nearestFound = nearestFound;
+        report.approximateAccuracy = report.sampled == 0 ? 0.0 : static_cast<double>(approximateCorrect) / report.sampled;
+        report.exactAccuracy = report.sampled == 0 ? 0.0 : static_cast<double>(exactCorrect) / report.sampled;
+        return report;
+    }
+
+    // Starts an incremental search from the empty feature subset
+    void beginIncrementalSearch()
+    {
+        beginDecrementalSearch(FeatureSubset());
+    }
+
+    // Leave-one-out accuracy of the committed subset plus one extra feature.
+    // Only the candidate's column is scanned, so this costs O(N^2) regardless
+    // of how many features have already been committed.
+    double evaluateWithFeature(size_t feature) const
+    {
+        return evaluateWithFeatureBounded(feature, NoTarget).accuracy;
+    }
+
+    BoundedAccuracy evaluateWithFeatureBounded(size_t feature, double targetAccuracy) const
+    {
+        FeatureSubset candidateSubset = matrixFeatures.with(feature);
+        return memoized(candidateSubset, targetAccuracy, [&]()
+                        { return evaluateAgainstMatrix(normalizedData.column(feature), 1.0, candidateSubset.indices(), targetAccuracy); });
+    }
+
+    // Folds the chosen feature into the distance matrix
+    void commitFeature(size_t feature)
+    {
+        distanceMatrix.addFeature(normalizedData.column(feature));
+        matrixFeatures.add(feature);
+    }
+
+    // Starts a decremental search from the given feature subset
+    void beginDecrementalSearch(const FeatureSubset &featureSubset)
+    {
+        distanceMatrix.reset(normalizedData.getNumInstances());
+        matrixFeatures = FeatureSubset();
+        for (size_t feature : featureSubset)
+        {
+            commitFeature(feature);
+        }
+    }
+
+    // Leave-one-out accuracy of the committed subset with one feature removed,
+    // found by subtracting that feature's column from the full distances
+    double evaluateWithoutFeature(size_t feature) const
+    {
+        return evaluateWithoutFeatureBounded(feature, NoTarget).accuracy;
+    }
+
+    BoundedAccuracy evaluateWithoutFeatureBounded(size_t feature, double targetAccuracy) const
+    {
+        FeatureSubset candidateSubset = matrixFeatures.without(feature);
+        return memoized(candidateSubset, targetAccuracy, [&]()
+                        { return evaluateAgainstMatrix(normalizedData.column(feature), -1.0, candidateSubset.indices(), targetAccuracy); });
+    }
+
+    // Permanently drops a feature from the distance matrix
+    void removeFeature(size_t feature)
+    {
+        distanceMatrix.removeFeature(normalizedData.column(feature));
+        matrixFeatures.remove(feature);
+    }
+
+    // Sets aside distance matrices for enumerateGrayCode, one per pool
+    // worker but no more than fit in budgetBytes, and returns how many.
+    // Each is allocated by the first enumeration that uses it and kept for
+    // the next; a budget of zero frees them all.
+    size_t reserveGrayCodeMatrices(size_t budgetBytes)
+    {
+        size_t numInstances = normalizedData.getNumInstances();
+        size_t matrixBytes = max<size_t>(numInstances * numInstances * sizeof(double), 1);
+        size_t count = supportsDistanceMatrix() ? min(pool.size(), budgetBytes / matrixBytes) : 0;
+        grayCodeMatrices.clear();
+        grayCodeMatrices.shrink_to_fit();
+        grayCodeMatrices.resize(count);
+        return count;
+    }
+
+    // Calls visit(subset, accuracy) for the subsets with Gray-code ranks
+    // begin to end - 1, in rank order. Rank r stands for the features whose
+    // bits are set in r ^ (r >> 1), so consecutive subsets differ by exactly
+    // one feature, and the distance matrix reserved for slot takes one
+    // column per subset, in the same pass that scores it, instead of being
+    // rebuilt. Rank 0, the empty subset, is never visited. It is rebuilt every
+    // GrayCodeRebuildInterval ranks all the same, so rounding left behind by
+    // adding and removing columns never nears MatrixTolerance. Accuracies
+    // are exactly those of evaluate(). Calls with different slots may run
+    // on different workers at once.
+    template <typename Visit>
+    void enumerateGrayCode(uint64_t begin, uint64_t end, size_t slot, const Visit &visit) const
+    {
+        NN_METRIC_TIMER("evaluate_gray_code");
+        if (!supportsDistanceMatrix() || normalizedData.getNumInstances() < 2 || slot >= grayCodeMatrices.size())
+        {
+            throw runtime_error("Gray-code enumeration needs a reserved distance matrix");
+        }
+        size_t numInstances = normalizedData.getNumInstances();
+        PairwiseDistanceMatrix &matrix = grayCodeMatrices[slot];
+        FeatureSubset subset;
+        for (uint64_t rank = max<uint64_t>(begin, 1); rank < end; rank++)
+        {
+            if (rank == max<uint64_t>(begin, 1) || rank % GrayCodeRebuildInterval == 0)
+            {
+                uint64_t code = (rank - 1) ^ ((rank - 1) >> 1);
+                subset = FeatureSubset::FromWords(&code, 1);
+                matrix.reset(numInstances);
+                for (size_t feature : subset)
+                {
+                    matrix.addFeature(normalizedData.column(feature));
+                }
+            }
+
+            // Rank r flips the feature numbered by its lowest set bit
+            size_t feature = static_cast<size_t>(__builtin_ctzll(rank));
+            double sign = subset.contains(feature) ? -1.0 : 1.0;
+            if (sign > 0)
+            {
+                subset.add(feature);
+            }
+            else
+            {
+                subset.remove(feature);
+            }
+            size_t correct = applyAndCountCorrect(matrix, normalizedData.column(feature), sign, subset.indices());
+            NN_METRIC_COUNT("folds", numInstances);
+            visit(subset, static_cast<double>(correct) / numInstances);
+        }
+    }
+
+    // Early-abandon work summed over every worker's classifier
+    ScanCounters getScanCounters() const
+    {
+        ScanCounters total;
+        for (const NearestNeighborClassifier &classifier : classifiers)
+        {
+            total += classifier.GetScanCounters();
+        }
+        return total;
+    }
+
+    size_t getNumFeatures() const
+    {
+        return store != nullptr ? store->getNumColumns() : normalizedData.getNumColumns();
+    }
+
+    size_t getNumInstances() const
+    {
+        return store != nullptr ? store->getNumInstances() : normalizedData.getNumInstances();
+    }
+};
+
+// The Titanic dataset is recognized by its file name
+bool IsTitanicFile(const string &fileName)
+{
+    return fileName == "titanic.txt" || fileName == "titanic-clean.txt";
+}
+
+// Handles reading different dataset formats. Splits off the labels and goes
+// through the binary cache next to the file unless useCache is off.
+PreparedDataset ReadData(const string &fileName, ThreadPool &pool, bool useCache = true)
+{
+    // First, check if this is a Titanic dataset by fileName
+    bool isTitanic = IsTitanicFile(fileName);
+
+    // Titanic values come in groups of 7, dropping any incomplete trailing
+    // group; the standard format (scientific notation) has one instance per line
+    PreparedDataset data = LoadPreparedDataset(fileName, isTitanic ? 7 : 0, useCache, pool);
+
+    if (isTitanic)
+    {
+        cout << "\nTitanic Dataset Features:\n"
+             << "1. Passenger Class (1-3)\n"
+             << "2. Sex (1 = male, 2 = female)\n"
+             << "3. Age\n"
+             << "4. Number of Siblings/Spouses\n"
+             << "5. Number of Parents/Children\n"
+             << "6. Fare\n";
+    }
+
+    if (data.features.empty())
+    {
+        throw runtime_error("No valid data found in file");
+    }
+
+    // The label is counted as one of each instance's values
+    cout << "Read " << data.features.getNumInstances() << " instances with "
+         << data.features.getNumColumns() + 1 << " values each\n";
+
+    return data;
+}
+
+// Streams a dataset with one instance per line into its on-disk column
+// store, holding about memoryBudget bytes at a time, and opens the store
+unique_ptr<ColumnStore> ReadDataOutOfCore(const string &fileName, ThreadPool &pool, size_t memoryBudget)
+{
+    unique_ptr<ColumnStore> store = OpenColumnStore(fileName, memoryBudget, pool);
+    if (store->getNumInstances() == 0)
+    {
+        throw runtime_error("No valid data found in file");
+    }
+
+    cout << "Read " << store->getNumInstances() << " instances with "
+         << store->getNumColumns() + 1 << " values each\n";
+
+    return store;
+}
+
+// Prints the 1-based numbers of the features, separated by separator
+void PrintFeatures(ostream &out, const FeatureSubset &features, const char *separator)
+{
+    bool first = true;
+    for (size_t feature : features)
+    {
+        out << (first ? "" : separator) << (feature + 1);
+        first = false;
+    }
+}
+
+// Scores every candidate of a search level at once on the pool. Results come
+// back in candidate order, so the printed output and the tie-break (the first,
+// i.e. lowest, feature index wins) are the same as scoring them one by one.
+// With prune set, score(feature, target) is given the best accuracy any
+// candidate of the level has reached so far and may stop once it cannot
+// beat it. Which candidates get pruned then depends on the order they finish
+// in, but the winner does not.
+template <typename Score>
+vector<BoundedAccuracy> ScoreCandidates(ThreadPool &pool, const vector<size_t> &candidates, bool prune, const Score &score)
+{
+    vector<BoundedAccuracy> results(candidates.size());
+    atomic<double> levelBest{Validator::NoTarget};
+    pool.parallelFor(candidates.size(), 1, [&](size_t begin, size_t end, size_t)
+                     {
+                         for (size_t c = begin; c < end; c++)
+                         {
+                             results[c] = score(candidates[c], prune ? levelBest.load() : Validator::NoTarget);
+                             double best = levelBest.load();
+                             while (!results[c].pruned && results[c].accuracy > best &&
+                                    !levelBest.compare_exchange_weak(best, results[c].accuracy))
+                             {
+                             }
+                         } });
+    return results;
+}
+
+// What --benchmark generates and how often it repeats each measurement
+struct BenchmarkOptions
+{
+    bool enabled = false;
+    SyntheticSpec data;
+    size_t repetitions = 5;
+};
+
+// Settings that can be given on the command line; the interactive prompts
+// cover the dataset and search choices
+struct ProgramOptions
+{
+    size_t numThreads = max(1u, thread::hardware_concurrency());
+    EvaluationOptions evaluation;
+    bool prune = false;             // Stop scoring candidates that cannot win their level
+    RaceOptions race;               // Eliminate clearly worse candidates on samples first
+    bool useDistanceMatrix = true;  // Score candidates incrementally when the matrix fits
+    bool useCache = true;           // Load and keep the binary dataset cache next to the file
+    size_t memoryBudget = 0;        // Bytes; nonzero streams the dataset from disk instead of loading it
+    size_t matrixBudget = size_t(2048) << 20; // Bytes the exhaustive search's distance matrices may hold together
+    bool evaluationCache = false;   // Reuse subset accuracies from earlier searches and runs
+    string evaluationCachePath;     // Defaults to a file next to the dataset
+    BenchmarkOptions benchmark;     // Replaces the interactive run when enabled
+    bool metricsSummary = false;    // Print the metrics tables after the results
+    string metricsJsonPath;         // Where to dump the metrics as JSON, if anywhere
+    string metricsPrometheusPath;   // Where to dump them in Prometheus text format
+    bool perfCounters = false;      // Read hardware counters around the evaluation phases
+    size_t knnMaxK = 0;             // Report k-NN accuracies of the best subset for k up to this
+};
+
+ProgramOptions ParseOptions(int argc, char *argv[])
+{
+    ProgramOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument.rfind("--threads=", 0) == 0)
+        {
+            int numThreads = stoi(argument.substr(string("--threads=").size()));
+            if (numThreads < 1)
+            {
+                throw runtime_error("--threads must be at least 1");
+            }
+            options.numThreads = numThreads;
+        }
+        else if (argument.rfind("--knn=", 0) == 0)
+        {
+            options.knnMaxK = stoul(argument.substr(string("--knn=").size()));
+        }
+        else if (argument == "--prune")
+        {
+            options.prune = true;
+        }
+        else if (argument == "--race")
+        {
+            options.race.enabled = true;
+        }
+        else if (argument.rfind("--race=", 0) == 0)
+        {
+            options.race.enabled = true;
+            options.race.bound = ParseRaceBound(argument.substr(string("--race=").size()));
+        }
+        else if (argument.rfind("--race-confidence=", 0) == 0)
+        {
+            options.race.confidence = stod(argument.substr(string("--race-confidence=").size()));
+        }
+        else if (argument.rfind("--race-initial=", 0) == 0)
+        {
+            options.race.initialSample = stoul(argument.substr(string("--race-initial=").size()));
+        }
+        else if (argument.rfind("--race-seed=", 0) == 0)
+        {
+            options.race.seed = stoull(argument.substr(string("--race-seed=").size()));
+        }
+        else if (argument.rfind("--precision=", 0) == 0)
+        {
+            options.evaluation.precision = ParseValuePrecision(argument.substr(string("--precision=").size()));
+        }
+        else if (argument.rfind("--validation=", 0) == 0)
+        {
+            options.evaluation.validation.strategy = ParseValidationStrategy(argument.substr(string("--validation=").size()));
+        }
+        else if (argument.rfind("--folds=", 0) == 0)
+        {
+            options.evaluation.validation.folds = stoul(argument.substr(string("--folds=").size()));
+        }
+        else if (argument.rfind("--holdout-fraction=", 0) == 0)
+        {
+            options.evaluation.validation.holdoutFraction = stod(argument.substr(string("--holdout-fraction=").size()));
+        }
+        else if (argument.rfind("--holdout-repetitions=", 0) == 0)
+        {
+            options.evaluation.validation.repetitions = stoul(argument.substr(string("--holdout-repetitions=").size()));
+        }
+        else if (argument.rfind("--validation-seed=", 0) == 0)
+        {
+            options.evaluation.validation.seed = stoull(argument.substr(string("--validation-seed=").size()));
+        }
+        else if (argument.rfind("--memory-budget=", 0) == 0)
+        {
+            // Given in MiB
+            options.memoryBudget = stoul(argument.substr(string("--memory-budget=").size())) << 20;
+        }
+        else if (argument.rfind("--matrix-budget=", 0) == 0)
+        {
+            // Given in MiB
+            options.matrixBudget = stoul(argument.substr(string("--matrix-budget=").size())) << 20;
+        }
+        else if (argument == "--eval-cache")
+        {
+            options.evaluationCache = true;
+        }
+        else if (argument.rfind("--eval-cache=", 0) == 0)
+        {
+            options.evaluationCache = true;
+            options.evaluationCachePath = argument.substr(string("--eval-cache=").size());
+        }
+        else if (argument == "--metrics")
+        {
+            options.metricsSummary = true;
+        }
+        else if (argument.rfind("--metrics-json=", 0) == 0)
+        {
+            options.metricsJsonPath = argument.substr(string("--metrics-json=").size());
+        }
+        else if (argument.rfind("--metrics-prometheus=", 0) == 0)
+        {
+            options.metricsPrometheusPath = argument.substr(string("--metrics-prometheus=").size());
+        }
+        else if (argument == "--perf-counters")
+        {
+            options.perfCounters = true;
+        }
+        else if (argument == "--benchmark")
+        {
+            options.benchmark.enabled = true;
+        }
+        else if (argument.rfind("--bench-instances=", 0) == 0)
+        {
+            options.benchmark.data.numInstances = stoul(argument.substr(string("--bench-instances=").size()));
+        }
+        else if (argument.rfind("--bench-features=", 0) == 0)
+        {
+            options.benchmark.data.numFeatures = stoul(argument.substr(string("--bench-features=").size()));
+        }
+        else if (argument.rfind("--bench-relevant=", 0) == 0)
+        {
+            options.benchmark.data.numRelevant = stoul(argument.substr(string("--bench-relevant=").size()));
+        }
+        else if (argument.rfind("--bench-noise=", 0) == 0)
+        {
+            options.benchmark.data.noise = stod(argument.substr(string("--bench-noise=").size()));
+        }
+        else if (argument.rfind("--bench-seed=", 0) == 0)
+        {
+            options.benchmark.data.seed = stoull(argument.substr(string("--bench-seed=").size()));
+        }
+        else if (argument.rfind("--bench-repetitions=", 0) == 0)
+        {
+            options.benchmark.repetitions = stoul(argument.substr(string("--bench-repetitions=").size()));
+        }
+        else if (argument == "--no-cache")
+        {
+            options.useCache = false;
+        }
+        else if (argument == "--no-distance-matrix")
+        {
+            options.useDistanceMatrix = false;
+        }
+        else if (argument == "--spatial-index")
+        {
+            options.evaluation.spatialIndex = true;
+        }
+        else if (argument.rfind("--spatial-index-max-dims=", 0) == 0)
+        {
+            options.evaluation.spatialIndex = true;
+            options.evaluation.spatialIndexMaxDims = stoul(argument.substr(string("--spatial-index-max-dims=").size()));
+        }
+        else if (argument == "--approximate")
+        {
+            options.evaluation.approximate.enabled = true;
+        }
+        else if (argument.rfind("--approximate=", 0) == 0)
+        {
+            options.evaluation.approximate.enabled = true;
+            options.evaluation.approximate.numTrees = stoul(argument.substr(string("--approximate=").size()));
+        }
+        else if (argument.rfind("--approximate-leaf=", 0) == 0)
+        {
+            options.evaluation.approximate.leafSize = stoul(argument.substr(string("--approximate-leaf=").size()));
+        }
+        else if (argument.rfind("--approximate-seed=", 0) == 0)
+        {
+            options.evaluation.approximate.seed = stoull(argument.substr(string("--approximate-seed=").size()));
+        }
+        else if (argument.rfind("--approximate-sample=", 0) == 0)
+        {
+            options.evaluation.approximate.calibrationSample = stoul(argument.substr(string("--approximate-sample=").size()));
+        }
+        else if (argument == "--all-pairs")
+        {
+            options.evaluation.blockedAllPairs = true;
+        }
+        else if (argument == "--early-abandon")
+        {
+            options.evaluation.earlyAbandon = true;
+        }
+        else if (argument == "--order-by-variance")
+        {
+            options.evaluation.earlyAbandon = true;
+            options.evaluation.orderByVariance = true;
+        }
+        else
+        {
+            throw runtime_error("Unknown option: " + argument);
+        }
+    }
+    return options;
+}
+
+// Outcome of a forward or backward search
+struct SearchResult
 {
-private:
-    vector<vector<double>> trainingData;
-    vector<int> trainingLabels;
+    FeatureSubset bestFeatures;
+    double bestAccuracy = 0.0;
+    size_t scoredCandidates = 0;
+    size_t prunedCandidates = 0;
+    size_t eliminatedCandidates = 0; // By racing
+    size_t foldsSpent = 0;           // Held-out predictions made, with racing on
+    size_t fullFolds = 0;            // What scoring every candidate in full would make
+};
 
-public:
-    void Train(const vector<vector<double>> &instances, const vector<int> &labels)
+// Scores a level's candidates with score(feature, target). With racing on
+// they first race on samples of held-out instances (see Racing.h); the
+// losers keep their race estimate and are marked in race.eliminated.
+// Survivors that the race saw through every instance have their exact
+// accuracy already, and one left alone earlier is scored in full.
+// subsetOf(feature) is the subset a candidate stands for.
+template <typename SubsetOf, typename Score>
+vector<BoundedAccuracy> ScoreLevel(Validator &validator, ThreadPool &pool, const ProgramOptions &options,
+                                   const vector<size_t> &candidates, size_t level, const SubsetOf &subsetOf,
+                                   const Score &score, RaceResult &race, SearchResult &result, ostream &out)
+{
+    result.scoredCandidates += candidates.size();
+    if (!options.race.enabled)
     {
-        trainingData = instances;
-        trainingLabels = labels;
+        race.eliminated.assign(candidates.size(), 0);
+        return ScoreCandidates(pool, candidates, options.prune, score);
+    }
+    if (!validator.supportsRacing())
+    {
+        throw runtime_error("Racing needs exact leave-one-out validation over an in-memory dataset");
     }
 
-    void TrainWithIDs(const vector<int> &instanceIDs,
-                      const vector<vector<double>> &fullDataset,
-                      const vector<int> &allLabels)
+    size_t numInstances = validator.getNumInstances();
+    race = RaceCandidates(pool, candidates.size(), numInstances, options.race, options.race.seed + level,
+                          [&](size_t c, const vector<size_t> &instances)
+                          { return validator.countCorrectOn(subsetOf(candidates[c]), instances); });
+    vector<size_t> unfinished;
+    size_t survivors = 0;
+    for (size_t c = 0; c < candidates.size(); c++)
     {
-        trainingData.clear();
-        trainingLabels.clear();
-        for (int id : instanceIDs)
+        survivors += !race.eliminated[c];
+        if (!race.eliminated[c] && race.folds[c] < numInstances)
         {
-            trainingData.push_back(fullDataset[id]);
-            trainingLabels.push_back(allLabels[id]);
+            unfinished.push_back(candidates[c]);
         }
     }
+    vector<BoundedAccuracy> unfinishedAccuracies = ScoreCandidates(pool, unfinished, options.prune, score);
 
-    int Test(const vector<double> &instance) const
+    vector<BoundedAccuracy> accuracies(candidates.size());
+    for (size_t c = 0, u = 0; c < candidates.size(); c++)
     {
-        if (trainingData.empty())
+        bool exact = !race.eliminated[c] && race.folds[c] == numInstances;
+        accuracies[c] = race.eliminated[c] || exact ? BoundedAccuracy{race.estimates[c], false} : unfinishedAccuracies[u++];
+    }
+
+    size_t levelFolds = race.foldsSpent + unfinished.size() * numInstances;
+    result.eliminatedCandidates += candidates.size() - survivors;
+    result.foldsSpent += levelFolds;
+    result.fullFolds += candidates.size() * numInstances;
+    NN_METRIC_COUNT("race_folds", race.foldsSpent);
+    out << "Racing eliminated " << candidates.size() - survivors << " of " << candidates.size()
+        << " candidates; the level made " << levelFolds << " held-out predictions instead of "
+        << candidates.size() * numInstances << endl;
+    return accuracies;
+}
+
+// Greedily adds the feature that helps most until targetSize are chosen,
+// writing every candidate's accuracy to out
+SearchResult ForwardSelection(Validator &validator, ThreadPool &pool, const ProgramOptions &options,
+                              size_t targetSize, ostream &out)
+{
+    SearchResult result;
+    FeatureSubset currentFeatures;
+    bool useMatrix = options.useDistanceMatrix && validator.supportsDistanceMatrix();
+    if (useMatrix)
+    {
+        validator.beginIncrementalSearch();
+    }
+    while (currentFeatures.size() < targetSize)
+    {
+        Metrics::Stopwatch levelTime;
+        size_t levelPruned = 0;
+        int bestFeature = -1;
+        double bestLocalAcc = 0.0;
+
+        // Try adding each unused feature
+        vector<size_t> candidates;
+        for (size_t i = 0; i < validator.getNumFeatures(); i++)
         {
-            throw runtime_error("Classifier must be trained before testing!");
+            if (!currentFeatures.contains(i))
+            {
+                candidates.push_back(i);
+            }
         }
+        RaceResult race;
+        vector<BoundedAccuracy> accuracies = ScoreLevel(validator, pool, options, candidates, currentFeatures.size() + 1,
+                                                        [&](size_t feature)
+                                                        { return currentFeatures.with(feature); },
+                                                        [&](size_t feature, double target)
+        {
+            if (useMatrix)
+            {
+                return validator.evaluateWithFeatureBounded(feature, target);
+            }
+            return validator.evaluateBounded(currentFeatures.with(feature), target);
+        }, race, result, out);
 
-        double minDistance = numeric_limits<double>::max();
-        int nearestLabel = trainingLabels[0];
-
-        for (size_t i = 0; i < trainingData.size(); i++)
+        for (size_t c = 0; c < candidates.size(); c++)
         {
-            double distance = 0.0;
-            for (size_t j = 0; j < instance.size(); j++)
+            size_t i = candidates[c];
+            double acc = accuracies[c].accuracy;
+            out << "Using feature(s) {";
+            PrintFeatures(out, currentFeatures.with(i), ",");
+            if (race.eliminated[c])
+            {
+                out << "} accuracy is about " << fixed << setprecision(3) << acc << " (eliminated by race after "
+                    << race.folds[c] << " folds)" << endl;
+                continue;
+            }
+            if (accuracies[c].pruned)
             {
-                double difference = instance[j] - trainingData[i][j];
-                distance += difference * difference;
+                out << "} accuracy is below " << fixed << setprecision(3) << acc << " (pruned)" << endl;
+                levelPruned++;
+                continue;
             }
+            out << "} accuracy is " << fixed << setprecision(3) << acc << endl;
 
-            if (distance < minDistance)
+            if (acc > bestLocalAcc)
             {
-                minDistance = distance;
-                nearestLabel = trainingLabels[i];
+                bestLocalAcc = acc;
+                bestFeature = i;
             }
         }
+        result.prunedCandidates += levelPruned;
+        NN_METRIC_LEVEL("forward", currentFeatures.size() + 1, candidates.size(), levelPruned, bestLocalAcc,
+                        levelTime.milliseconds());
 
-        return nearestLabel;
-    }
+        if (bestFeature == -1)
+        {
+            break;
+        }
+        currentFeatures.add(bestFeature);
+        if (useMatrix)
+        {
+            validator.commitFeature(bestFeature);
+        }
 
-    int TestWithID(int instanceID, const vector<vector<double>> &fullDataset) const
-    {
-        return Test(fullDataset[instanceID]);
+        if (bestLocalAcc > result.bestAccuracy)
+        {
+            result.bestAccuracy = bestLocalAcc;
+            result.bestFeatures = currentFeatures;
+        }
+        else
+        {
+            out << "Warning! Accuracy has decreased!\n";
+        }
+
+        out << "Feature set {";
+        PrintFeatures(out, currentFeatures, ",");
+        out << "} was best, accuracy is " << fixed << setprecision(3) << bestLocalAcc << endl;
     }
-};
+    return result;
+}
 
-// The Validator class handles data preprocessing and evaluation
-class Validator
+// Starts from every feature and repeatedly drops the one whose removal
+// helps most until targetSize remain, writing every candidate to out
+SearchResult BackwardElimination(Validator &validator, ThreadPool &pool, const ProgramOptions &options,
+                                 size_t targetSize, ostream &out)
 {
-private:
-    vector<vector<double>> normalizedData;
-    vector<int> labels;
-    NearestNeighborClassifier *classifier;
-
-    // Prevent implicit copying
-    Validator(const Validator &) = delete;
-    Validator &operator=(const Validator &) = delete;
-
-public:
-    Validator(const vector<vector<double>> &data, const vector<int> &labels)
-    {
-        this->normalizedData = normalizeData(data);
-        this->labels = labels;
-        classifier = new NearestNeighborClassifier();
-    }
+    SearchResult result;
+    FeatureSubset currentFeatures = FeatureSubset::All(validator.getNumFeatures());
 
-    ~Validator()
+    // Evaluate initial accuracy once
+    result.bestAccuracy = validator.evaluate(currentFeatures);
+    bool useMatrix = options.useDistanceMatrix && validator.supportsDistanceMatrix();
+    if (useMatrix)
     {
-        delete classifier;
+        validator.beginDecrementalSearch(currentFeatures);
     }
+    out << "\nStarting with all features. Initial accuracy is "
+        << fixed << setprecision(3) << result.bestAccuracy << endl;
 
-    vector<vector<double>> normalizeData(const vector<vector<double>> &data)
+    while (currentFeatures.size() > targetSize)
     {
-        vector<vector<double>> normalizedData = data;
-        size_t numInstances = data.size();
-        size_t numFeatures = data[0].size();
+        Metrics::Stopwatch levelTime;
+        size_t levelPruned = 0;
+        int featureToRemove = -1;
+        double bestLocalAcc = 0.0;
 
-        for (size_t j = 0; j < numFeatures; ++j)
+        // Score the subset without each feature straight from the distance matrix
+        vector<size_t> candidates = currentFeatures.indices();
+        RaceResult race;
+        vector<BoundedAccuracy> accuracies = ScoreLevel(validator, pool, options, candidates, currentFeatures.size() - 1,
+                                                        [&](size_t feature)
+                                                        { return currentFeatures.without(feature); },
+                                                        [&](size_t feature, double target)
         {
-            double minVal = data[0][j];
-            double maxVal = data[0][j];
-
-            for (size_t i = 0; i < numInstances; ++i)
-            {
-                minVal = min(minVal, data[i][j]);
-                maxVal = max(maxVal, data[i][j]);
-            }
-
-            if (maxVal > minVal)
+            if (useMatrix)
             {
-                for (size_t i = 0; i < numInstances; ++i)
-                {
-                    normalizedData[i][j] = (data[i][j] - minVal) / (maxVal - minVal);
-                }
+                return validator.evaluateWithoutFeatureBounded(feature, target);
             }
-        }
-        return normalizedData;
-    }
-
-    double evaluate(const vector<size_t> &featureSubset)
-    {
-        int correctPredictions = 0;
-        size_t numInstances = normalizedData.size();
+            return validator.evaluateBounded(currentFeatures.without(feature), target);
+        }, race, result, out);
 
-        // Perform leave-one-out cross validation
-        for (size_t i = 0; i < numInstances; i++)
+        for (size_t i = 0; i < candidates.size(); i++)
         {
-            vector<double> instance;
-            for (size_t j : featureSubset)
+            double accuracy = accuracies[i].accuracy;
+            if (race.eliminated[i])
             {
-                instance.push_back(normalizedData[i][j]);
+                out << "Removed feature " << (candidates[i] + 1) << ", accuracy about " << fixed << setprecision(3)
+                    << accuracy << " (eliminated by race after " << race.folds[i] << " folds)" << endl;
+                continue;
             }
-
-            vector<vector<double>> trainData;
-            vector<int> trainLabels;
-            for (int k = 0; k < numInstances; k++)
+            if (accuracies[i].pruned)
             {
-                if (k != i)
-                {
-                    vector<double> trainInstance;
-                    for (size_t j : featureSubset)
-                    {
-                        trainInstance.push_back(normalizedData[k][j]);
-                    }
-                    trainData.push_back(trainInstance);
-                    trainLabels.push_back(labels[k]);
-                }
+                out << "Removed feature " << (candidates[i] + 1)
+                    << ", accuracy below " << fixed << setprecision(3) << accuracy << " (pruned)" << endl;
+                levelPruned++;
+                continue;
             }
+            out << "Removed feature " << (candidates[i] + 1)
+                << ", accuracy: " << fixed << setprecision(3) << accuracy << endl;
 
-            classifier->Train(trainData, trainLabels);
-            int predictedLabel = classifier->Test(instance);
-            if (predictedLabel == labels[i])
+            if (accuracy > bestLocalAcc)
             {
-                correctPredictions++;
+                bestLocalAcc = accuracy;
+                featureToRemove = candidates[i];
             }
         }
+        result.prunedCandidates += levelPruned;
+        NN_METRIC_LEVEL("backward", currentFeatures.size() - 1, candidates.size(), levelPruned, bestLocalAcc,
+                        levelTime.milliseconds());
 
-        return static_cast<double>(correctPredictions) / numInstances;
-    }
+        if (featureToRemove == -1)
+        {
+            break;
+        }
+        out << "\nPermanently removed feature " << (featureToRemove + 1) << endl;
+        if (useMatrix)
+        {
+            validator.removeFeature(featureToRemove);
+        }
+        currentFeatures.remove(featureToRemove);
 
-    size_t getNumFeatures() const
-    {
-        return normalizedData[0].size();
+        if (bestLocalAcc > result.bestAccuracy)
+        {
+            result.bestAccuracy = bestLocalAcc;
+            result.bestFeatures = currentFeatures;
+        }
+
+        out << "Current feature set: {";
+        PrintFeatures(out, currentFeatures, ", ");
+        out << "} accuracy: " << bestLocalAcc << endl
+            << endl;
     }
-};
+    return result;
+}
+
+// Exhaustive search visits 2^F subsets; beyond this many features that is out of reach
+constexpr size_t MaxExhaustiveFeatures = 24;
 
-// Handles reading different dataset formats
-vector<vector<double>> ReadData(const string &fileName)
+// A subset and its accuracy; the placeholder loses to any real subset
+struct SubsetScore
 {
-    vector<vector<double>> data;
-    ifstream file(fileName);
+    FeatureSubset features;
+    double accuracy = -1.0;
+};
 
-    if (!file)
+// Whether features, scoring accuracy, should replace best. Higher accuracy
+// wins; ties go to fewer features and then to the lexicographically
+// smaller list of features, so the answer does not depend on the order
+// subsets were scored in.
+bool BeatsSubset(double accuracy, const FeatureSubset &features, const SubsetScore &best)
+{
+    if (accuracy != best.accuracy)
     {
-        throw runtime_error("Cannot open file: " + fileName);
+        return accuracy > best.accuracy;
     }
+    if (features.size() != best.features.size())
+    {
+        return features.size() < best.features.size();
+    }
+    vector<size_t> mine = features.indices(), theirs = best.features.indices();
+    return lexicographical_compare(mine.begin(), mine.end(), theirs.begin(), theirs.end());
+}
 
-    // First, check if this is a Titanic dataset by fileName
-    bool isTitanic = (fileName == "titanic.txt" || fileName == "titanic-clean.txt");
-
-    if (isTitanic)
+// Scores every nonempty subset of the features and writes the best of each
+// size and the best overall to out. Subsets are visited in Gray-code order,
+// split into ranges that the workers enumerate independently, each over a
+// distance matrix of its own (see Validator::enumerateGrayCode). Workers
+// get a matrix only while they fit in options.matrixBudget together; the
+// others, or all of them without the matrix, score every subset through
+// evaluate() instead. The matrix is only offered where it scores exactly
+// as evaluate() does (not under variance ordering, for one), so the result
+// does not depend on the budget or on the number of threads.
+SearchResult ExhaustiveSearch(Validator &validator, ThreadPool &pool, const ProgramOptions &options, ostream &out)
+{
+    NN_METRIC_TIMER("exhaustive_search");
+    size_t numFeatures = validator.getNumFeatures();
+    if (numFeatures == 0 || numFeatures > MaxExhaustiveFeatures)
     {
-        // Handle Titanic format specifically
-        vector<double> allValues;
-        double value;
+        throw runtime_error("Exhaustive search needs between 1 and " + to_string(MaxExhaustiveFeatures) + " features");
+    }
+    uint64_t numSubsets = (uint64_t(1) << numFeatures) - 1;
+    size_t matrixSlots = options.useDistanceMatrix ? validator.reserveGrayCodeMatrices(options.matrixBudget) : 0;
 
-        while (file >> value)
-        {
-            allValues.push_back(value);
-        }
+    // Each range rebuilds its matrix first, so ranges are kept long enough
+    // for that to be a small part of their work
+    vector<vector<SubsetScore>> workerBest(pool.size(), vector<SubsetScore>(numFeatures + 1));
+    size_t chunkSize = max<size_t>(64, numSubsets / (pool.size() * 4));
+    pool.parallelFor(numSubsets, chunkSize, [&](size_t begin, size_t end, size_t worker)
+                     {
+                         vector<SubsetScore> &best = workerBest[worker];
+                         auto visit = [&](const FeatureSubset &subset, double accuracy)
+                         {
+                             if (BeatsSubset(accuracy, subset, best[subset.size()]))
+                             {
+                                 best[subset.size()] = {subset, accuracy};
+                             }
+                         };
+                         // Rank 0 is the empty subset, which is skipped
+                         if (worker < matrixSlots)
+                         {
+                             validator.enumerateGrayCode(begin + 1, end + 1, worker, visit);
+                             return;
+                         }
+                         for (uint64_t rank = begin + 1; rank <= end; rank++)
+                         {
+                             uint64_t code = rank ^ (rank >> 1);
+                             FeatureSubset subset = FeatureSubset::FromWords(&code, 1);
+                             visit(subset, validator.evaluate(subset));
+                         } });
+    validator.reserveGrayCodeMatrices(0);
 
-        // Process values in groups of 7
-        for (size_t i = 0; i < allValues.size(); i += 7)
+    SearchResult result;
+    result.scoredCandidates = numSubsets;
+    SubsetScore overall;
+    out << "\nScored all " << numSubsets << " nonempty subsets of " << numFeatures << " features" << endl;
+    for (size_t size = 1; size <= numFeatures; size++)
+    {
+        SubsetScore bestOfSize;
+        for (const vector<SubsetScore> &best : workerBest)
         {
-            if (i + 6 < allValues.size())
+            if (best[size].accuracy >= 0.0 && BeatsSubset(best[size].accuracy, best[size].features, bestOfSize))
             {
-                vector<double> instance(allValues.begin() + i, allValues.begin() + i + 7);
-                data.push_back(instance);
+                bestOfSize = best[size];
             }
         }
+        out << "Best subset of size " << size << ": {";
+        PrintFeatures(out, bestOfSize.features, ",");
+        out << "} accuracy is " << fixed << setprecision(3) << bestOfSize.accuracy << endl;
+        if (BeatsSubset(bestOfSize.accuracy, bestOfSize.features, overall))
+        {
+            overall = bestOfSize;
+        }
+    }
+    result.bestFeatures = overall.features;
+    result.bestAccuracy = overall.accuracy;
+    out << "Feature set {";
+    PrintFeatures(out, overall.features, ",");
+    out << "} was best overall, accuracy is " << fixed << setprecision(3) << overall.accuracy << endl;
+    return result;
+}
 
-        cout << "\nTitanic Dataset Features:\n"
-             << "1. Passenger Class (1-3)\n"
-             << "2. Sex (1 = male, 2 = female)\n"
-             << "3. Age\n"
-             << "4. Number of Siblings/Spouses\n"
-             << "5. Number of Parents/Children\n"
-             << "6. Fare\n";
+// Wall-clock milliseconds of each of repetitions calls to body
+template <typename Body>
+vector<double> TimeRepetitions(size_t repetitions, const Body &body)
+{
+    vector<double> samples;
+    for (size_t r = 0; r < repetitions; r++)
+    {
+        auto start = chrono::steady_clock::now();
+        body();
+        auto stop = chrono::steady_clock::now();
+        samples.push_back(chrono::duration<double, milli>(stop - start).count());
     }
-    else
+    return samples;
+}
+
+// Writes one benchmark case as a JSON object: the median, mean, sample
+// variance and range of its timings
+void WriteTimingJson(ostream &out, const string &name, vector<double> samples, bool last)
+{
+    sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    double median = n % 2 == 1 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    double mean = 0.0;
+    for (double sample : samples)
     {
-        // Handle standard format (scientific notation)
-        string line;
-        while (getline(file, line))
-        {
-            // Skip empty lines
-            if (line.empty() || line.find_first_not_of(" \t") == string::npos)
-            {
-                continue;
-            }
+        mean += sample;
+    }
+    mean /= n;
+    double variance = 0.0;
+    for (double sample : samples)
+    {
+        variance += (sample - mean) * (sample - mean);
+    }
+    variance = n > 1 ? variance / (n - 1) : 0.0;
 
-            vector<double> instance;
-            istringstream iss(line);
-            double value;
+    out << "    {\"name\": \"" << name << "\", \"median_ms\": " << median << ", \"mean_ms\": " << mean
+        << ", \"variance_ms2\": " << variance << ", \"min_ms\": " << samples.front()
+        << ", \"max_ms\": " << samples.back() << "}" << (last ? "\n" : ",\n");
+}
 
-            // Keep reading values until we can't read anymore
-            while (iss >> value)
-            {
-                instance.push_back(value);
-            }
+// Times normalization, single evaluations of growing subsets and complete
+// forward and backward searches on a generated dataset, and writes the
+// results to out as JSON. The evaluation cache is never used, since it
+// would answer every repetition after the first.
+void RunBenchmark(const ProgramOptions &options, ThreadPool &pool, ostream &out)
+{
+    const BenchmarkOptions &benchmark = options.benchmark;
+    SyntheticDataset generated = GenerateSyntheticDataset(benchmark.data);
+    Dataset rawFeatures = generated.data;
+    rawFeatures.removeColumn(0);
+    PreparedDataset prepared = PrepareDataset(generated.data);
+    Validator validator(prepared, pool, options.evaluation);
+    size_t numFeatures = benchmark.data.numFeatures;
+    ostream discard(nullptr); // The searches' progress is not wanted here
 
-            // Only add non-empty instances
-            if (!instance.empty())
-            {
-                data.push_back(instance);
-            }
-        }
+    vector<pair<string, vector<double>>> cases;
+    cases.emplace_back("normalize", TimeRepetitions(benchmark.repetitions, [&]()
+                                                    { Validator::normalizeData(rawFeatures); }));
+    for (size_t size = 1; size <= numFeatures; size = size * 2 > numFeatures && size < numFeatures ? numFeatures : size * 2)
+    {
+        FeatureSubset subset = FeatureSubset::All(size);
+        cases.emplace_back("evaluate/" + to_string(size), TimeRepetitions(benchmark.repetitions, [&]()
+                                                                          { validator.evaluate(subset); }));
     }
+    SearchResult forward, backward;
+    cases.emplace_back("forward_search", TimeRepetitions(benchmark.repetitions, [&]()
+                                                         { forward = ForwardSelection(validator, pool, options, numFeatures, discard); }));
+    cases.emplace_back("backward_search", TimeRepetitions(benchmark.repetitions, [&]()
+                                                          { backward = BackwardElimination(validator, pool, options, 1, discard); }));
 
-    if (data.empty())
+    out << "{\n";
+    out << "  \"dataset\": {\"instances\": " << benchmark.data.numInstances << ", \"features\": " << numFeatures
+        << ", \"relevant\": " << benchmark.data.numRelevant << ", \"noise\": " << benchmark.data.noise
+        << ", \"seed\": " << benchmark.data.seed << ", \"relevant_features\": [";
+    for (size_t j = 0; j < generated.relevantFeatures.size(); j++)
     {
-        throw runtime_error("No valid data found in file");
+        out << (j == 0 ? "" : ", ") << generated.relevantFeatures[j] + 1;
+    }
+    out << "]},\n";
+    out << "  \"settings\": {\"threads\": " << pool.size() << ", \"hardware_threads\": " << thread::hardware_concurrency()
+        << ", \"repetitions\": " << benchmark.repetitions << ", \"precision\": \""
+        << ValuePrecisionName(options.evaluation.precision) << "\", \"validation\": \""
+        << DescribeValidation(options.evaluation.validation) << "\", \"early_abandon\": "
+        << (options.evaluation.earlyAbandon ? "true" : "false") << ", \"order_by_variance\": "
+        << (options.evaluation.orderByVariance ? "true" : "false") << ", \"spatial_index\": "
+        << (options.evaluation.spatialIndex ? "true" : "false") << ", \"all_pairs\": "
+        << (options.evaluation.blockedAllPairs ? "true" : "false") << ", \"approximate_trees\": "
+        << (options.evaluation.approximate.enabled ? options.evaluation.approximate.numTrees : 0) << ", \"prune\": "
+        << (options.prune ? "true" : "false") << ", \"race\": \""
+        << (options.race.enabled ? RaceBoundName(options.race.bound) : "off") << "\", \"distance_matrix\": "
+        << (options.useDistanceMatrix && validator.supportsDistanceMatrix() ? "true" : "false") << "},\n";
+    // What the searches found, so a change that alters results shows up too
+    for (const SearchResult *search : {&forward, &backward})
+    {
+        out << "  \"" << (search == &forward ? "forward" : "backward") << "_best\": {\"features\": [";
+        PrintFeatures(out, search->bestFeatures, ", ");
+        out << "], \"accuracy\": " << search->bestAccuracy << "},\n";
+    }
+    out << "  \"results\": [\n";
+    for (size_t c = 0; c < cases.size(); c++)
+    {
+        WriteTimingJson(out, cases[c].first, cases[c].second, c + 1 == cases.size());
     }
+    out << "  ]\n}\n";
+}
 
-    // Verify all instances have the same number of values
-    size_t numValues = data[0].size();
-    for (size_t i = 1; i < data.size(); i++)
+// Writes the metrics collected during the run wherever the options ask for
+// them: the summary tables (and hardware counters, if on) to summaryOut,
+// the dumps to their files
+void ReportMetrics(const ProgramOptions &options, ostream &summaryOut)
+{
+    if (options.metricsSummary)
+    {
+        Metrics::WriteSummary(summaryOut);
+    }
+    if (!options.metricsJsonPath.empty())
     {
-        if (data[i].size() != numValues)
+        ofstream file(options.metricsJsonPath);
+        Metrics::WriteJson(file);
+        if (!file)
         {
-            throw runtime_error("Inconsistent number of values across instances");
+            throw runtime_error("Cannot write metrics: " + options.metricsJsonPath);
         }
     }
-
-    cout << "Read " << data.size() << " instances with "
-         << data[0].size() << " values each\n";
-
-    return data;
+    if (!options.metricsPrometheusPath.empty())
+    {
+        ofstream file(options.metricsPrometheusPath);
+        Metrics::WritePrometheus(file);
+        if (!file)
+        {
+            throw runtime_error("Cannot write metrics: " + options.metricsPrometheusPath);
+        }
+    }
+    if (PerfCounters::Profiler::instance().isEnabled())
+    {
+        PerfCounters::Profiler::instance().report(summaryOut);
+    }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     try
     {
+        ProgramOptions options = ParseOptions(argc, argv);
+        string perfUnavailable;
+        if (options.perfCounters && !PerfCounters::Profiler::instance().enable(perfUnavailable))
+        {
+            // Still worth running; the kernel may just not allow counting here
+            cerr << "Hardware counters unavailable: " << perfUnavailable << "\n";
+        }
+        if (options.benchmark.enabled)
+        {
+            if (options.benchmark.repetitions == 0 || options.benchmark.data.numInstances < 2 ||
+                options.benchmark.data.numFeatures == 0)
+            {
+                throw runtime_error("Benchmark needs at least one repetition, two instances and one feature");
+            }
+            ThreadPool pool(options.numThreads);
+            RunBenchmark(options, pool, cout);
+            ReportMetrics(options, cerr); // Keeps standard output valid JSON
+            return 0;
+        }
+
+
         cout << "Welcome to the Feature Selection Program\n\n";
         cout << "Which dataset would you like to analyze?\n";
         cout << "1. Small Dataset (100 instances, 10 features)\n";
@@ -322,180 +2441,68 @@ int main()
         cout << "\nSelect search algorithm:\n";
         cout << "1. Forward Selection\n";
         cout << "2. Backward Elimination\n";
-        cout << "Enter your choice (1-2): ";
+        cout << "3. Exhaustive Search (every subset)\n";
+        cout << "Enter your choice (1-3): ";
         int algorithmChoice;
         cin >> algorithmChoice;
         // Read and prepare dataset
-        vector<vector<double>> data = ReadData(fileName);
-        vector<int> labels;
-
-        // Extract labels and remove them from features
-        for (const vector<double> &instance : data)
+        ThreadPool pool(options.numThreads);
+        PreparedDataset data;
+        unique_ptr<ColumnStore> store; // Only with a memory budget; Titanic is always held in memory
+        if (options.memoryBudget != 0 && !IsTitanicFile(fileName))
         {
-            labels.push_back(static_cast<int>(instance[0]));
+            store = ReadDataOutOfCore(fileName, pool, options.memoryBudget);
         }
-        for (vector<double> &instance : data)
+        else
         {
-            instance.erase(instance.begin());
+            data = ReadData(fileName, pool, options.useCache);
         }
+        size_t numInstances = store ? store->getNumInstances() : data.features.getNumInstances();
 
         // Verify dataset dimensions
-        if (choice == 1 && data.size() != 100)
+        if (choice == 1 && numInstances != 100)
         {
             throw runtime_error("Small dataset must have exactly 100 instances");
         }
-        if (choice == 2 && data.size() != 1000)
+        if (choice == 2 && numInstances != 1000)
         {
             throw runtime_error("Large dataset must have exactly 1000 instances");
         }
 
         // Create validator and initialize feature selection
-        Validator validator(data, labels);
-        set<int> bestFeatures;
-        double bestAccuracy = 0.0;
-
-        if (algorithmChoice == 1)
+        unique_ptr<Validator> validatorOwner =
+            store ? make_unique<Validator>(*store, options.memoryBudget, pool, options.evaluation)
+                  : make_unique<Validator>(data, pool, options.evaluation);
+        Validator &validator = *validatorOwner;
+        unique_ptr<EvaluationCache> evaluationCache;
+        if (options.evaluationCache)
         {
-            // Forward Selection with ordered output
-            vector<size_t> currentFeatures; // Use vector instead of set for controlled ordering
-            while (currentFeatures.size() < k)
+            if (options.evaluationCachePath.empty())
             {
-                int bestFeature = -1;
-                double bestLocalAcc = 0.0;
-
-                // Try adding each unused feature
-                for (size_t i = 0; i < data[0].size(); i++)
-                {
-                    // Check if feature i is already selected
-                    if (find(currentFeatures.begin(), currentFeatures.end(), i) == currentFeatures.end())
-                    {
-                        vector<size_t> testFeatures = currentFeatures;  // Copy current features
-                        testFeatures.push_back(i);                      // Add new feature
-                        sort(testFeatures.begin(), testFeatures.end()); // Keep sorted order
-
-                        double acc = validator.evaluate(testFeatures);
-                        cout << "Using feature(s) {";
-                        for (size_t j = 0; j < testFeatures.size(); j++)
-                        {
-                            cout << (testFeatures[j] + 1);
-                            if (j < testFeatures.size() - 1)
-                                cout << ",";
-                        }
-                        cout << "} accuracy is " << fixed << setprecision(3) << acc << endl;
-
-                        if (acc > bestLocalAcc)
-                        {
-                            bestLocalAcc = acc;
-                            bestFeature = i;
-                        }
-                    }
-                }
-
-                if (bestFeature != -1)
-                {
-                    currentFeatures.push_back(bestFeature);
-                    sort(currentFeatures.begin(), currentFeatures.end()); // Maintain sorted order
-
-                    if (bestLocalAcc > bestAccuracy)
-                    {
-                        bestAccuracy = bestLocalAcc;
-                        bestFeatures.clear();
-                        // Convert sorted vector to set
-                        for (size_t feature : currentFeatures)
-                        {
-                            bestFeatures.insert(feature);
-                        }
-                    }
-                    else
-                    {
-                        cout << "Warning! Accuracy has decreased!\n";
-                    }
-
-                    cout << "Feature set {";
-                    for (size_t j = 0; j < currentFeatures.size(); j++)
-                    {
-                        cout << (currentFeatures[j] + 1);
-                        if (j < currentFeatures.size() - 1)
-                            cout << ",";
-                    }
-                    cout << "} was best, accuracy is " << fixed << setprecision(3) << bestLocalAcc << endl;
-                }
+                options.evaluationCachePath = fileName + ".evals";
             }
+            evaluationCache = make_unique<EvaluationCache>(options.evaluationCachePath);
+            validator.useCache(*evaluationCache);
         }
-else if (algorithmChoice == 2) {
-    // Backward Elimination with optimization
-    vector<size_t> currentFeatures;
-    // Start with all features but in a vector for faster operations
-    for (size_t i = 0; i < data[0].size(); i++) {
-        currentFeatures.push_back(i);
-    }
-    
-    // Evaluate initial accuracy once
-    bestAccuracy = validator.evaluate(currentFeatures);
-    cout << "\nStarting with all features. Initial accuracy is " 
-         << fixed << setprecision(3) << bestAccuracy << endl;
-
-    while (currentFeatures.size() > k) {
-        int featureToRemove = -1;
-        double bestLocalAcc = 0.0;
-        vector<size_t> testFeatures;
-        
-        // Reserve space to avoid reallocations
-        testFeatures.reserve(currentFeatures.size() - 1);
-
-        for (size_t i = 0; i < currentFeatures.size(); i++) {
-            // Create test set by copying all features except the one we're testing
-            testFeatures.clear();
-            for (size_t j = 0; j < currentFeatures.size(); j++) {
-                if (j != i) {
-                    testFeatures.push_back(currentFeatures[j]);
-                }
-            }
-
-            double accuracy = validator.evaluate(testFeatures);
-            cout << "Removed feature " << (currentFeatures[i] + 1) 
-                 << ", accuracy: " << fixed << setprecision(3) << accuracy << endl;
-
-            if (accuracy > bestLocalAcc) {
-                bestLocalAcc = accuracy;
-                featureToRemove = i;  // Store index in currentFeatures vector
-            }
+        SearchResult result;
+        if (algorithmChoice == 1)
+        {
+            result = ForwardSelection(validator, pool, options, k, cout);
         }
-
-        if (featureToRemove != -1) {
-            // Remove the feature by its index in our vector
-            cout << "\nPermanently removed feature " << (currentFeatures[featureToRemove] + 1) << endl;
-            currentFeatures.erase(currentFeatures.begin() + featureToRemove);
-
-            if (bestLocalAcc > bestAccuracy) {
-                bestAccuracy = bestLocalAcc;
-                // Convert to set only when updating best features
-                bestFeatures.clear();
-                for (size_t feature : currentFeatures) {
-                    bestFeatures.insert(feature);
-                }
-            }
-
-            cout << "Current feature set: {";
-            for (size_t i = 0; i < currentFeatures.size(); i++) {
-                cout << (currentFeatures[i] + 1);
-                if (i < currentFeatures.size() - 1) cout << ", ";
-            }
-            cout << "} accuracy: " << bestLocalAcc << endl << endl;
+        else if (algorithmChoice == 2)
+        {
+            result = BackwardElimination(validator, pool, options, k, cout);
         }
-    }
-}
+        else if (algorithmChoice == 3)
+        {
+            result = ExhaustiveSearch(validator, pool, options, cout);
+        }
+        const FeatureSubset &bestFeatures = result.bestFeatures;
+        double bestAccuracy = result.bestAccuracy;
         // Display final results
         cout << "\nResults for " << datasetName << " Dataset:\n";
         cout << "Best Feature Subset: {";
-        int count = 0;
-        for (int feature : bestFeatures)
-        {
-            cout << (feature + 1); // Convert to 1-based indexing for display
-            if (count < bestFeatures.size() - 1)
-                cout << ", ";
-            count++;
-        }
+        PrintFeatures(cout, bestFeatures, ", ");
         cout << "}\nAccuracy: " << fixed << setprecision(3) << bestAccuracy << "\n";
 
         // Show reference accuracies for small and large datasets
@@ -507,6 +2514,83 @@ else if (algorithmChoice == 2) {
         {
             cout << "\nReference: Should find features {1, 15, 27} with accuracy ~0.949\n";
         }
+
+        if (options.evaluation.validation.strategy != ValidationStrategy::LeaveOneOut)
+        {
+            cout << "\nAccuracies are from " << DescribeValidation(options.evaluation.validation) << "\n";
+        }
+
+        if (options.prune)
+        {
+            cout << "\nPruned " << result.prunedCandidates << " of " << result.scoredCandidates
+                 << " candidate evaluations before they finished\n";
+        }
+
+        if (options.race.enabled)
+        {
+            cout << "\nRacing (" << RaceBoundName(options.race.bound) << ", " << defaultfloat << options.race.confidence * 100
+                 << "% confidence) eliminated " << result.eliminatedCandidates << " of " << result.scoredCandidates
+                 << " candidates; the search made " << result.foldsSpent << " held-out predictions instead of "
+                 << result.fullFolds << "\n";
+        }
+
+        if (evaluationCache)
+        {
+            EvaluationCache::Stats stats = evaluationCache->getStats();
+            cout << "\nEvaluation cache answered " << stats.hits << " of " << stats.hits + stats.misses
+                 << " subset evaluations (" << stats.entries << " entries, " << stats.loaded
+                 << " loaded from " << options.evaluationCachePath << ")\n";
+        }
+
+        if (options.evaluation.precision != ValuePrecision::Double && !store)
+        {
+            PrecisionReport report = validator.comparePrecision(bestFeatures);
+            cout << "\n" << ValuePrecisionName(options.evaluation.precision) << " storage changed "
+                 << report.changedPredictions << " of " << report.numInstances
+                 << " leave-one-out predictions for the best subset (accuracy "
+                 << fixed << setprecision(3) << report.reducedAccuracy << " vs "
+                 << report.doubleAccuracy << " with doubles)\n";
+        }
+
+        if (options.knnMaxK != 0)
+        {
+            NeighborVotingAccuracies knn = validator.evaluateForEachK(bestFeatures, options.knnMaxK);
+            size_t bestMajority = 0, bestWeighted = 0;
+            cout << "\nk-NN leave-one-out accuracy of the best subset, from one pass:\n";
+            cout << "  k  majority  distance-weighted\n";
+            for (size_t k = 0; k < knn.majority.size(); k++)
+            {
+                cout << setw(3) << k + 1 << fixed << setprecision(3) << setw(10) << knn.majority[k] << setw(19)
+                     << knn.weighted[k] << "\n";
+                bestMajority = knn.majority[k] > knn.majority[bestMajority] ? k : bestMajority;
+                bestWeighted = knn.weighted[k] > knn.weighted[bestWeighted] ? k : bestWeighted;
+            }
+            cout << "Best k: " << bestMajority + 1 << " with majority votes (" << knn.majority[bestMajority] << "), "
+                 << bestWeighted + 1 << " with distance-weighted votes (" << knn.weighted[bestWeighted] << ")\n";
+        }
+
+        if (options.evaluation.approximate.enabled)
+        {
+            const ApproximateOptions &approximate = options.evaluation.approximate;
+            ApproximationReport report = validator.calibrateApproximate(bestFeatures);
+            cout << "\nApproximate neighbors (" << approximate.numTrees << " trees, leaves of " << approximate.leafSize
+                 << ") found the exact nearest neighbor for " << report.nearestFound << " of " << report.sampled
+                 << " sampled instances; leave-one-out accuracy on the sample is " << fixed << setprecision(3)
+                 << report.approximateAccuracy << " vs " << report.exactAccuracy << " exact\n";
+        }
+
+        if (options.evaluation.earlyAbandon)
+        {
+            ScanCounters counters = validator.getScanCounters();
+            double percentSkipped = counters.dimensionOperations == 0
+                                        ? 0.0
+                                        : 100.0 * counters.dimensionsSkipped / counters.dimensionOperations;
+            cout << "\nEarly abandoning skipped " << counters.dimensionsSkipped << " of "
+                 << counters.dimensionOperations << " dimension operations ("
+                 << fixed << setprecision(1) << percentSkipped << "%)\n";
+        }
+
+        ReportMetrics(options, cout);
     }
     catch (const exception &e)
     {